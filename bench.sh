@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# runs example (multithread_example by default) with 1 - 64 threads, prints time in ms for every thread number.
+# library should be built before with needed args, for example:
+# ./build.sh THREAD_SAFE && ./bench.sh > mutex.txt
+# ./build.sh THREAD_SAFE HUGE_PAGES && ./bench.sh tlb_example > huge_pages.txt
+
+EXAMPLE=${1:-multithread_example}
+RUNS=${RUNS:-3}
+
+for threads in 1 2 4 8 16 32 64; do
+  for run in $(seq "$RUNS"); do
+    echo "$threads $(./"$EXAMPLE" "$threads")"
+  done
+done
@@ -13,6 +13,6 @@ done
 cmake -S . -B build $CMAKE_ARGS
 make -C build -j 8
 
-# args is SAFE_FREE and\or THREAD_SAFE
+# args is SAFE_FREE and\or THREAD_SAFE and\or THREAD_CACHE and\or ARENAS and\or REMOTE_FREE and\or FINE_GRAINED_LOCKS and\or RUNTIME_LOCK_ELISION and\or DEFERRED_FREE and\or DECAY and\or LOCK_PROFILING and\or SEGREGATED_FREE_LISTS and\or TINY_SLABS and\or TLSF and\or DEFERRED_COALESCING and\or ZONE_STATE_LISTS and\or MEDIUM_CLASS and\or BUDDY_ALLOCATOR and\or LARGE_CACHE and\or LARGE_REMAP and\or LARGE_TRIM and\or HUGE_PAGES and\or PURGE_FREE_SPANS
 # install_name_tool -add_rpath ./ ./a.out <- through static link
 # DYLD_LIBRARY_PATH=$PWD DYLD_INSERT_LIBRARIES=libft_malloc_x86_64_Darwin.so DYLD_FORCE_FLAT_NAMESPACE=1 ./a.out <- through dynamic link
@@ -0,0 +1,247 @@
+#include "malloc_internal.h"
+#include "utilities.h"
+
+#ifdef BUDDY_ALLOCATOR
+t_buddy_allocator gBuddyAllocators[ARENAS_COUNT] = {[0 ... ARENAS_COUNT - 1] = {.lock = LOCK_INITIALIZER}};
+
+static inline t_buddy_region* get_block_region(void* block) {
+    return (t_buddy_region*)((uint64_t)block & ~(uint64_t)(BUDDY_REGION_SIZE - 1));
+}
+
+static inline uint64_t get_block_page(t_buddy_region* region, void* block) {
+    return (uint64_t)((BYTE*)block - (BYTE*)region) / BUDDY_PAGE_SIZE;
+}
+
+static inline BYTE* get_page_block(t_buddy_region* region, uint64_t page) {
+    return (BYTE*)region + page * BUDDY_PAGE_SIZE;
+}
+
+/// the smallest order whose block holds size bytes.
+static inline uint64_t to_buddy_order(uint64_t size) {
+    uint64_t pages_number = (size + BUDDY_PAGE_SIZE - 1) / BUDDY_PAGE_SIZE;
+    return pages_number <= 1 ? 0 : 64 - (uint64_t)__builtin_clzll(pages_number - 1);
+}
+
+#define BUDDY_METADATA_ORDER (to_buddy_order(sizeof(t_buddy_region)))
+#define BUDDY_REGION_FREE_PAGES_COUNT (BUDDY_REGION_PAGES_COUNT - (1ull << BUDDY_METADATA_ORDER))
+
+static void add_block_to_free_list(t_buddy_allocator* allocator, t_buddy_region* region, BYTE* raw_block,
+                                   uint64_t order) {
+    t_buddy_block* block = (t_buddy_block*)raw_block;
+    region->page_orders[get_block_page(region, block)] = (BYTE)order | BUDDY_PAGE_FREE;
+    block->prev = NULL;
+    block->next = allocator->free_blocks[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    allocator->free_blocks[order] = block;
+    allocator->free_blocks_bitmap |= 1u << order;
+}
+
+static void delete_block_from_free_list(t_buddy_allocator* allocator, t_buddy_region* region, BYTE* raw_block,
+                                        uint64_t order) {
+    t_buddy_block* block = (t_buddy_block*)raw_block;
+    region->page_orders[get_block_page(region, block)] = (BYTE)order;
+    if (block->prev) {
+        block->prev->next = block->next;
+    }
+    else {
+        allocator->free_blocks[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    if (allocator->free_blocks[order] == NULL) {
+        allocator->free_blocks_bitmap &= ~(1u << order);
+    }
+}
+
+/// block is split until it has required order, upper halves go to free lists.
+static void split_block(t_buddy_allocator* allocator, t_buddy_region* region, BYTE* block, uint64_t order,
+                        uint64_t required_order) {
+    while (order > required_order) {
+        --order;
+        add_block_to_free_list(allocator, region, block + ((uint64_t)BUDDY_PAGE_SIZE << order), order);
+    }
+    region->page_orders[get_block_page(region, block)] = (BYTE)required_order;
+}
+
+/// twice bigger mapping is trimmed, so region is aligned to its size. Allocator lock should be held.
+static t_buddy_region* create_buddy_region(t_buddy_allocator* allocator) {
+    BYTE* mapping = (BYTE*)mmap(NULL, 2 * BUDDY_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                                VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+    if ((void*)mapping == MAP_FAILED) {
+        return NULL;
+    }
+    BYTE* region_start = (BYTE*)(((uint64_t)mapping + BUDDY_REGION_SIZE - 1) & ~(uint64_t)(BUDDY_REGION_SIZE - 1));
+    if (region_start != mapping) {
+        munmap(mapping, region_start - mapping);
+    }
+    munmap(region_start + BUDDY_REGION_SIZE, mapping + BUDDY_REGION_SIZE - region_start);
+
+    /// mapping is zeroed, so no page is marked free yet
+    t_buddy_region* region = (t_buddy_region*)region_start;
+    region->allocator = allocator;
+    region->free_pages_number = BUDDY_REGION_FREE_PAGES_COUNT;
+    split_block(allocator, region, region_start, BUDDY_REGION_ORDER, BUDDY_METADATA_ORDER);
+
+    region->prev = NULL;
+    region->next = allocator->first_region;
+    if (region->next) {
+        region->next->prev = region;
+    }
+    allocator->first_region = region;
+    ++allocator->empty_regions_number;
+    return region;
+}
+
+/// free blocks of totally free region are taken from lists before unmap. Allocator lock should be held.
+static void delete_buddy_region(t_buddy_allocator* allocator, t_buddy_region* region) {
+    uint64_t page = 1ull << BUDDY_METADATA_ORDER;
+    while (page < BUDDY_REGION_PAGES_COUNT) {
+        uint64_t order = region->page_orders[page] & ~BUDDY_PAGE_FREE;
+        delete_block_from_free_list(allocator, region, get_page_block(region, page), order);
+        page += 1ull << order;
+    }
+    if (region->prev) {
+        region->prev->next = region->next;
+    }
+    else {
+        allocator->first_region = region->next;
+    }
+    if (region->next) {
+        region->next->prev = region->prev;
+    }
+}
+
+/// required_size should be 16 byte aligned and fit buddy range.
+/// Returns large zone with the smallest block for required_size or NULL if region can't be mapped.
+t_zone* buddy_create_zone(t_memory_zones* arena, uint64_t required_size) {
+    t_buddy_allocator* allocator = &gBuddyAllocators[arena - gArenas];
+    uint64_t order = to_buddy_order(ZONE_HEADER_SIZE + NODE_HEADER_SIZE + required_size);
+
+    lock_acquire(&allocator->lock);
+    uint32_t fitting_orders = allocator->free_blocks_bitmap & ~((1u << order) - 1);
+    if (fitting_orders == 0) {
+        if (!create_buddy_region(allocator)) {
+            lock_release(&allocator->lock);
+            return NULL;
+        }
+        fitting_orders = allocator->free_blocks_bitmap & ~((1u << order) - 1);
+    }
+    uint64_t block_order = (uint64_t)__builtin_ctz(fitting_orders);
+    BYTE* block = (BYTE*)allocator->free_blocks[block_order];
+    t_buddy_region* region = get_block_region(block);
+    if (region->free_pages_number == BUDDY_REGION_FREE_PAGES_COUNT) {
+        --allocator->empty_regions_number;
+    }
+    delete_block_from_free_list(allocator, region, block, block_order);
+    split_block(allocator, region, block, block_order, order);
+    region->free_pages_number -= 1ull << order;
+    lock_release(&allocator->lock);
+
+    t_zone* zone = (t_zone*)block;
+    if (!construct_zone_header(zone, (uint64_t)BUDDY_PAGE_SIZE << order, Large, arena)) {
+        zone->buddy_region = region;
+        buddy_release_zone(zone);
+        return NULL;
+    }
+    zone->buddy_region = region;
+    return zone;
+}
+
+/// block is merged with its buddies and returned to free lists, region is unmapped if it's totally free
+/// and enough empty regions are kept already.
+void buddy_release_zone(t_zone* zone) {
+#ifdef SAFE_FREE
+    page_map_clear(zone);
+#endif
+    t_buddy_region* region = zone->buddy_region;
+    t_buddy_allocator* allocator = region->allocator;
+    uint64_t order = to_buddy_order(ZONE_HEADER_SIZE + zone->total_size);
+    uint64_t page = get_block_page(region, zone);
+
+    lock_acquire(&allocator->lock);
+    region->free_pages_number += 1ull << order;
+    while (order < BUDDY_REGION_ORDER - 1) {
+        uint64_t buddy_page = page ^ (1ull << order);
+        if (region->page_orders[buddy_page] != (order | BUDDY_PAGE_FREE)) {
+            break;
+        }
+        delete_block_from_free_list(allocator, region, get_page_block(region, buddy_page), order);
+        page &= ~(1ull << order);
+        ++order;
+    }
+    add_block_to_free_list(allocator, region, get_page_block(region, page), order);
+
+    if (region->free_pages_number == BUDDY_REGION_FREE_PAGES_COUNT) {
+        if (allocator->empty_regions_number < BUDDY_MAX_EMPTY_REGIONS) {
+            ++allocator->empty_regions_number;
+        }
+        else {
+            delete_buddy_region(allocator, region);
+            lock_release(&allocator->lock);
+            munmap(region, BUDDY_REGION_SIZE);
+            return;
+        }
+    }
+    lock_release(&allocator->lock);
+}
+
+#ifdef LARGE_TRIM
+/// upper halves of block which aren't needed for required_size are purged and go to free lists.
+/// Their buddies are parts of taken block, so they aren't merged.
+void buddy_trim_zone(t_zone* zone, uint64_t required_size) {
+    uint64_t order = to_buddy_order(ZONE_HEADER_SIZE + zone->total_size);
+    uint64_t new_order = to_buddy_order(ZONE_HEADER_SIZE + NODE_HEADER_SIZE + required_size);
+    uint64_t tail_size = ((uint64_t)BUDDY_PAGE_SIZE << order) - ((uint64_t)BUDDY_PAGE_SIZE << new_order);
+    if (tail_size < LARGE_TRIM_MIN_SIZE) {
+        return;
+    }
+    madvise((BYTE*)zone + ((uint64_t)BUDDY_PAGE_SIZE << new_order), tail_size, PURGE_PAGES_MADVISE);
+#ifdef SAFE_FREE
+    page_map_clear(zone);
+#endif
+    zone->total_size = ((uint64_t)BUDDY_PAGE_SIZE << new_order) - ZONE_HEADER_SIZE;
+#ifdef SAFE_FREE
+    page_map_set(zone, Large);
+#endif
+
+    t_buddy_region* region = zone->buddy_region;
+    t_buddy_allocator* allocator = region->allocator;
+    lock_acquire(&allocator->lock);
+    split_block(allocator, region, (BYTE*)zone, order, new_order);
+    region->free_pages_number += tail_size / BUDDY_PAGE_SIZE;
+    lock_release(&allocator->lock);
+}
+#endif
+
+/// lock isn't touched, it can be held by caller
+void buddy_clear() {
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        t_buddy_allocator* allocator = &gBuddyAllocators[i];
+        t_buddy_region* region = allocator->first_region;
+        while (region != NULL) {
+            t_buddy_region* next_region = region->next;
+            munmap(region, BUDDY_REGION_SIZE);
+            region = next_region;
+        }
+        bzero(allocator->free_blocks, sizeof(allocator->free_blocks));
+        allocator->free_blocks_bitmap = 0;
+        allocator->first_region = NULL;
+        allocator->empty_regions_number = 0;
+    }
+}
+
+void lock_buddy_allocators() {
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        lock_acquire(&gBuddyAllocators[i].lock);
+    }
+}
+
+void unlock_buddy_allocators() {
+    for (uint64_t i = ARENAS_COUNT; i > 0; --i) {
+        lock_release(&gBuddyAllocators[i - 1].lock);
+    }
+}
+#endif
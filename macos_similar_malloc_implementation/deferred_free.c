@@ -0,0 +1,70 @@
+#include "malloc_internal.h"
+#include "utilities.h"
+
+t_deferred_free_ring* gDeferredFreeRings = NULL;
+static t_lock gDeferredFreeRingsLock = LOCK_INITIALIZER;
+
+/// takes free ring or maps new one, rings are added to list head, so list can be walked without lock.
+t_deferred_free_ring* deferred_free_ring_acquire() {
+    t_deferred_free_ring* ring;
+
+    lock_acquire(&gDeferredFreeRingsLock);
+    for (ring = gDeferredFreeRings; ring != NULL; ring = ring->next) {
+        if (!ring->in_use) {
+            ring->in_use = TRUE;
+            lock_release(&gDeferredFreeRingsLock);
+            return ring;
+        }
+    }
+    lock_release(&gDeferredFreeRingsLock);
+
+    ring = (t_deferred_free_ring*)mmap(NULL, sizeof(t_deferred_free_ring), PROT_READ | PROT_WRITE,
+                                       MAP_ANON | MAP_PRIVATE, VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+    if ((void*)ring == MAP_FAILED) {
+        return NULL;
+    }
+    ring->in_use = TRUE;
+
+    lock_acquire(&gDeferredFreeRingsLock);
+    ring->next = gDeferredFreeRings;
+    __atomic_store_n(&gDeferredFreeRings, ring, __ATOMIC_RELEASE);
+    lock_release(&gDeferredFreeRingsLock);
+    return ring;
+}
+
+/// pointers left in ring are still freed by reclaimer.
+void deferred_free_ring_release(t_deferred_free_ring* ring) {
+    lock_acquire(&gDeferredFreeRingsLock);
+    ring->in_use = FALSE;
+    lock_release(&gDeferredFreeRingsLock);
+}
+
+/// called only by ring owner.
+BOOL deferred_free_push(t_deferred_free_ring* ring, void* ptr) {
+    uint64_t size = get_user_memory_size(ptr);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (ring->tail - head >= DEFERRED_FREE_RING_CAPACITY ||
+        __atomic_load_n(&ring->bytes, __ATOMIC_RELAXED) + size > DEFERRED_FREE_RING_MAX_BYTES) {
+        return FALSE;
+    }
+    ring->slots[ring->tail % DEFERRED_FREE_RING_CAPACITY] = ptr;
+    __atomic_add_fetch(&ring->bytes, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/// called only by reclaimer, returns NULL if ring is empty.
+void* deferred_free_pop(t_deferred_free_ring* ring) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (ring->head == tail) {
+        return NULL;
+    }
+    void* ptr = ring->slots[ring->head % DEFERRED_FREE_RING_CAPACITY];
+    __atomic_sub_fetch(&ring->bytes, get_user_memory_size(ptr), __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    return ptr;
+}
+
+uint64_t deferred_free_ring_size(t_deferred_free_ring* ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
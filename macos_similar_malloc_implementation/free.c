@@ -4,12 +4,43 @@
 void __free_all() {
     if (!gInit) { return; }
     gInit = FALSE;
+    __atomic_add_fetch(&gThreadCacheGeneration, 1, __ATOMIC_RELEASE);
 
-    clear_zone_list(gMemoryZones.first_tiny_zone);
-    clear_zone_list(gMemoryZones.first_small_zone);
-    clear_zone_list(gMemoryZones.first_large_allocation);
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        t_memory_zones* arena = &gArenas[i];
+        clear_zone_list(arena->first_tiny_zone);
+        clear_zone_list(arena->first_small_zone);
+#ifdef MEDIUM_CLASS
+        clear_zone_list(arena->first_medium_zone);
+        arena->first_medium_zone = NULL;
+        arena->last_medium_zone = NULL;
+#endif
+#ifdef ZONE_STATE_LISTS
+        for (uint64_t type = Tiny; type < ZONE_CLASSES_COUNT; ++type) {
+            clear_zone_list(arena->first_full_zones[type]);
+            clear_zone_list(arena->first_empty_zones[type]);
+        }
+        bzero(arena->first_full_zones, sizeof(arena->first_full_zones));
+        bzero(arena->last_full_zones, sizeof(arena->last_full_zones));
+        bzero(arena->first_empty_zones, sizeof(arena->first_empty_zones));
+        bzero(arena->last_empty_zones, sizeof(arena->last_empty_zones));
+#endif
 
-    bzero(&gMemoryZones, sizeof(t_memory_zones));
+        /// lock isn't touched, it can be held by caller
+        arena->first_tiny_zone = NULL;
+        arena->last_tiny_zone = NULL;
+        arena->first_small_zone = NULL;
+        arena->last_small_zone = NULL;
+        arena->remote_free_nodes = NULL;
+#ifdef TINY_SLABS
+        bzero(arena->slab_pages, sizeof(arena->slab_pages));
+        arena->empty_slab_pages = NULL;
+#endif
+    }
+    clear_large_allocations();
+#ifdef TINY_SLABS
+    slab_clear();
+#endif
 }
 
 static BOOL zone_list_contains_user_memory(t_zone* zone, void* ptr) {
@@ -23,16 +54,107 @@ static BOOL zone_list_contains_user_memory(t_zone* zone, void* ptr) {
     return FALSE;
 }
 
-static BOOL zones_contains_user_memory(void* ptr) {
-    if (zone_list_contains_user_memory(gMemoryZones.first_tiny_zone, ptr)) {
+BOOL arena_contains_user_memory(t_memory_zones* arena, void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        return slab_contains_user_memory(ptr) && get_slab_page(ptr)->arena == arena;
+    }
+#endif
+    if (zone_list_contains_user_memory(arena->first_tiny_zone, ptr)) {
         return TRUE;
     }
-    if (zone_list_contains_user_memory(gMemoryZones.first_small_zone, ptr)) {
+#ifdef ZONE_STATE_LISTS
+    /// empty zones don't have user memory
+    for (uint64_t type = Tiny; type < ZONE_CLASSES_COUNT; ++type) {
+        if (zone_list_contains_user_memory(arena->first_full_zones[type], ptr)) {
+            return TRUE;
+        }
+    }
+#endif
+#ifdef MEDIUM_CLASS
+    if (zone_list_contains_user_memory(arena->first_medium_zone, ptr)) {
         return TRUE;
     }
-    return zone_list_contains_user_memory(gMemoryZones.first_large_allocation, ptr);
+#endif
+    return zone_list_contains_user_memory(arena->first_small_zone, ptr);
+}
+
+#ifdef SAFE_FREE
+/// zone is found by page map. Large user memory always starts right after zone and node headers,
+/// tiny and small memory can be anywhere in zone. Zone memory isn't read: without locks zone can be unmapped
+/// meanwhile by racing free of the same ptr, so ptr is checked again under lock in __free.
+static t_zone* find_user_memory_zone(void* ptr, t_allocation_type* type, t_memory_zones** arena) {
+    t_zone* zone = page_map_get(ptr, type, arena);
+    if (zone == NULL || (BYTE*)ptr == (BYTE*)zone) {
+        return NULL;
+    }
+    if (*type == Large && (BYTE*)ptr != (BYTE*)zone + ZONE_HEADER_SIZE + NODE_HEADER_SIZE) {
+        return NULL;
+    }
+    return zone;
+}
+
+/// caller is responsible for locking of slab pages, zones are found without locks.
+BOOL zones_contains_user_memory(void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        return slab_contains_user_memory(ptr);
+    }
+#endif
+    t_allocation_type type;
+    return find_user_memory_zone(ptr, &type, NULL) != NULL;
 }
 
+t_memory_zones* find_user_memory_arena(void* ptr, t_allocation_type* type) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        *type = Tiny;
+        t_memory_zones* arena = __atomic_load_n(&get_slab_page(ptr)->arena, __ATOMIC_RELAXED);
+        if (arena == NULL) {
+            return NULL;
+        }
+        arena_lock_all_acquire(arena);
+        BOOL contains = slab_contains_user_memory(ptr);
+        arena_lock_all_release(arena);
+        return contains ? arena : NULL;
+    }
+#endif
+    t_memory_zones* arena;
+    return find_user_memory_zone(ptr, type, &arena) ? arena : NULL;
+}
+#else
+/// caller is responsible for locking, use find_user_memory_arena without locks held.
+BOOL zones_contains_user_memory(void* ptr) {
+    if (large_allocations_contains_user_memory(ptr)) {
+        return TRUE;
+    }
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        if (arena_contains_user_memory(&gArenas[i], ptr)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/// every arena is checked under its own locks.
+t_memory_zones* find_user_memory_arena(void* ptr, t_allocation_type* type) {
+    if (large_allocations_contains_user_memory(ptr)) {
+        *type = Large;
+        return get_user_memory_arena(ptr);
+    }
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        arena_lock_all_acquire(&gArenas[i]);
+        BOOL contains = arena_contains_user_memory(&gArenas[i], ptr);
+        arena_lock_all_release(&gArenas[i]);
+        if (contains) {
+            *type = get_user_memory_allocation_type(ptr);
+            return &gArenas[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
 void __free(void* ptr) {
     if (ptr == NULL) {
         return;
@@ -41,28 +163,73 @@ void __free(void* ptr) {
     if (!zones_contains_user_memory(ptr)) {
         return;
     }
+    t_allocation_type type;
+    if (page_map_get(ptr, &type, NULL) && type == Large) {
+        /// large allocation isn't unmapped under arena lock, it's checked again under its shard lock
+        large_free_user_memory(ptr);
+        return;
+    }
 #endif
+    free_user_memory(ptr);
+}
 
+/// ptr should be valid user memory, its arena lock should be held.
+void free_user_memory(void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+#endif
     BYTE* node = (BYTE*)ptr - NODE_HEADER_SIZE;
     t_allocation_type allocation_type = get_node_allocation_type(node);
+    t_memory_zones* arena = get_node_zone(node)->arena;
     if (allocation_type == Large) {
-        /// deallocate full large_allocation
-        t_zone* large_allocation = (t_zone*)(node - ZONE_HEADER_SIZE);
-        delete_zone_from_list(&gMemoryZones.first_large_allocation, &gMemoryZones.last_large_allocation,
-                              large_allocation);
-        munmap((void*)large_allocation, large_allocation->total_size + ZONE_HEADER_SIZE);
+        large_free(node);
         return;
     }
 
     t_zone** first_zone;
     t_zone** last_zone;
-    if (allocation_type == Tiny) {
-        first_zone = &gMemoryZones.first_tiny_zone;
-        last_zone = &gMemoryZones.last_tiny_zone;
+    get_class_zone_list(arena, allocation_type, &first_zone, &last_zone);
+    free_memory_in_zone_list(first_zone, last_zone, node);
+}
+
+/// Freeing thread doesn't take arena lock, node is pushed to arena remote free stack
+/// and stays occupied until owner drains it. Link to next node is kept in node user memory.
+void arena_push_remote_free(t_memory_zones* arena, void* ptr) {
+    BYTE* node = (BYTE*)ptr - NODE_HEADER_SIZE;
+    BYTE* first_node = __atomic_load_n(&arena->remote_free_nodes, __ATOMIC_RELAXED);
+    do {
+        *(BYTE**)(node + NODE_HEADER_SIZE) = first_node;
+    } while (!__atomic_compare_exchange_n(&arena->remote_free_nodes, &first_node, node, TRUE,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/// arena lock should be held. Whole stack is taken at once, so there is no ABA problem with concurrent pushes.
+void arena_drain_remote_frees(t_memory_zones* arena) {
+    if (__atomic_load_n(&arena->remote_free_nodes, __ATOMIC_RELAXED) == NULL) {
+        return;
     }
-    else {
-        first_zone = &gMemoryZones.first_small_zone;
-        last_zone = &gMemoryZones.last_small_zone;
+    BYTE* node = __atomic_exchange_n(&arena->remote_free_nodes, NULL, __ATOMIC_ACQUIRE);
+    while (node != NULL) {
+        BYTE* next_node = *(BYTE**)(node + NODE_HEADER_SIZE);
+        free_user_memory(node + NODE_HEADER_SIZE);
+        node = next_node;
+    }
+}
+
+/// Remote frees of arena nobody allocates from would stay there, so DECAY pass drains other arenas too.
+/// Caller can hold its arena lock, other arenas are only try-locked, busy ones are drained by their users.
+void drain_other_arenas_remote_frees(t_memory_zones* current_arena) {
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        t_memory_zones* arena = &gArenas[i];
+        if (arena == current_arena || __atomic_load_n(&arena->remote_free_nodes, __ATOMIC_RELAXED) == NULL) {
+            continue;
+        }
+        if (arena_lock_try_acquire(arena)) {
+            arena_drain_remote_frees(arena);
+            arena_lock_release(arena);
+        }
     }
-    free_memory_in_zone_list(first_zone, last_zone, node);
 }
\ No newline at end of file
@@ -0,0 +1,377 @@
+#ifdef __linux__
+#define _GNU_SOURCE  /// mremap
+#endif
+#include "malloc_internal.h"
+#include "utilities.h"
+
+t_large_allocations_shard gLargeAllocations[LARGE_ALLOCATIONS_SHARDS_COUNT] = {
+        [0 ... LARGE_ALLOCATIONS_SHARDS_COUNT - 1] = {.lock = LOCK_INITIALIZER}};
+
+static inline t_large_allocations_shard* get_large_allocation_shard(t_zone* large_allocation) {
+    return &gLargeAllocations[to_large_allocations_shard_index(large_allocation)];
+}
+
+#ifdef LARGE_CACHE
+t_large_cache gLargeCache = {.lock = LOCK_INITIALIZER};
+uint64_t gLargeCacheMaxBytes = LARGE_CACHE_MAX_BYTES_DEFAULT;
+uint64_t gLargeCacheDecayTimeMs = LARGE_CACHE_DECAY_TIME_DEFAULT_MS;
+
+static inline uint64_t to_large_cache_bucket(uint64_t mapping_size) {
+    uint64_t bucket = 63 - (uint64_t)__builtin_clzll(mapping_size / gPageSize);
+    return bucket < LARGE_CACHE_BUCKETS_COUNT ? bucket : LARGE_CACHE_BUCKETS_COUNT - 1;
+}
+
+/// cache lock should be held.
+static void delete_cached_zone(t_zone* zone, uint64_t bucket) {
+    delete_zone_from_list(&gLargeCache.first_zones[bucket], &gLargeCache.last_zones[bucket], zone);
+    gLargeCache.bytes -= get_zone_mapping_size(zone);
+}
+
+/// cache lock should be held. Zone is linked to evicted_zones, it's unmapped after lock is released.
+static void evict_cached_zone(t_zone* zone, uint64_t bucket, t_zone** evicted_zones) {
+    delete_cached_zone(zone, bucket);
+    zone->next = *evicted_zones;
+    *evicted_zones = zone;
+}
+
+/// every bucket is ordered by caching time, so only its oldest mappings are checked.
+static void decay_large_cache(uint64_t now, t_zone** evicted_zones) {
+    uint64_t decay_time = __atomic_load_n(&gLargeCacheDecayTimeMs, __ATOMIC_RELAXED);
+    for (uint64_t bucket = 0; bucket < LARGE_CACHE_BUCKETS_COUNT; ++bucket) {
+        t_zone* zone;
+        while ((zone = gLargeCache.first_zones[bucket]) != NULL && now >= zone->free_since + decay_time) {
+            evict_cached_zone(zone, bucket, evicted_zones);
+        }
+    }
+}
+
+/// the biggest mappings are evicted first, they are the cheapest to map again per byte.
+static void trim_large_cache(uint64_t max_bytes, t_zone** evicted_zones) {
+    uint64_t bucket = LARGE_CACHE_BUCKETS_COUNT;
+    while (gLargeCache.bytes > max_bytes && bucket > 0) {
+        if (gLargeCache.first_zones[bucket - 1] == NULL) {
+            --bucket;
+            continue;
+        }
+        evict_cached_zone(gLargeCache.first_zones[bucket - 1], bucket - 1, evicted_zones);
+    }
+}
+
+/// page map entries of cached zones are cleared already.
+static void unmap_evicted_zones(t_zone* zone) {
+    while (zone != NULL) {
+        t_zone* next_zone = zone->next;
+        munmap((void*)zone, get_zone_mapping_size(zone));
+        zone = next_zone;
+    }
+}
+
+/// returns cached zone with mapping from mapping_size to twice of it or NULL.
+static t_zone* take_cached_zone(t_memory_zones* arena, uint64_t mapping_size) {
+    t_zone* evicted_zones = NULL;
+    t_zone* cached_zone = NULL;
+    uint64_t now = decay_now();
+
+    lock_acquire(&gLargeCache.lock);
+    decay_large_cache(now, &evicted_zones);
+    uint64_t first_bucket = to_large_cache_bucket(mapping_size);
+    for (uint64_t bucket = first_bucket; bucket <= first_bucket + 1 && bucket < LARGE_CACHE_BUCKETS_COUNT; ++bucket) {
+        t_zone* zone = gLargeCache.last_zones[bucket];
+        for (uint64_t attempt = 0; zone != NULL && attempt < LARGE_CACHE_FIT_ATTEMPTS; ++attempt) {
+            uint64_t zone_mapping_size = get_zone_mapping_size(zone);
+            if (zone_mapping_size >= mapping_size && zone_mapping_size < 2 * mapping_size) {
+                cached_zone = zone;
+                break;
+            }
+            zone = zone->prev;
+        }
+        if (cached_zone) {
+            delete_cached_zone(cached_zone, bucket);
+            break;
+        }
+    }
+    lock_release(&gLargeCache.lock);
+    unmap_evicted_zones(evicted_zones);
+
+    if (cached_zone && !construct_zone_header(cached_zone, get_zone_mapping_size(cached_zone), Large, arena)) {
+        munmap((void*)cached_zone, get_zone_mapping_size(cached_zone));
+        return NULL;
+    }
+    return cached_zone;
+}
+
+/// returns FALSE if mapping is bigger than the whole cache, zone should be unmapped then.
+static BOOL put_zone_to_cache(t_zone* zone) {
+    uint64_t mapping_size = get_zone_mapping_size(zone);
+    uint64_t max_bytes = __atomic_load_n(&gLargeCacheMaxBytes, __ATOMIC_RELAXED);
+    if (mapping_size > max_bytes) {
+        return FALSE;
+    }
+#ifdef SAFE_FREE
+    page_map_clear(zone);
+#endif
+    t_zone* evicted_zones = NULL;
+    uint64_t bucket = to_large_cache_bucket(mapping_size);
+    zone->free_since = decay_now();
+
+    lock_acquire(&gLargeCache.lock);
+    decay_large_cache(zone->free_since, &evicted_zones);
+    add_zone_to_list(&gLargeCache.first_zones[bucket], &gLargeCache.last_zones[bucket], zone);
+    gLargeCache.bytes += mapping_size;
+    trim_large_cache(max_bytes, &evicted_zones);
+    lock_release(&gLargeCache.lock);
+    unmap_evicted_zones(evicted_zones);
+    return TRUE;
+}
+
+/// lock isn't touched, it can be held by caller
+void clear_large_cache() {
+    for (uint64_t bucket = 0; bucket < LARGE_CACHE_BUCKETS_COUNT; ++bucket) {
+        t_zone* zone = gLargeCache.first_zones[bucket];
+        while (zone != NULL) {
+            t_zone* next_zone = zone->next;
+            munmap((void*)zone, get_zone_mapping_size(zone));
+            zone = next_zone;
+        }
+        gLargeCache.first_zones[bucket] = NULL;
+        gLargeCache.last_zones[bucket] = NULL;
+    }
+    gLargeCache.bytes = 0;
+}
+#endif
+
+/// required_size should be 16 byte aligned. mmap is done before shard lock is taken.
+void* large_malloc(t_memory_zones* arena, size_t required_size) {
+    t_zone* large_allocation = NULL;
+#ifdef BUDDY_ALLOCATOR
+    if (required_size >= BUDDY_MIN_ALLOCATION_SIZE && required_size <= BUDDY_MAX_ALLOCATION_SIZE) {
+        large_allocation = buddy_create_zone(arena, required_size);
+    }
+#endif
+#ifdef LARGE_CACHE
+    if (!large_allocation) {
+        large_allocation = take_cached_zone(arena, calculate_zone_size(Large, required_size));
+    }
+#endif
+#ifdef PURGE_FREE_SPANS
+    BOOL new_mapping = large_allocation == NULL;
+#endif
+    if (!large_allocation) {
+        large_allocation = create_new_zone(calculate_zone_size(Large, required_size), Large, arena);
+    }
+    if (!large_allocation) {
+        return NULL;
+    }
+
+    BYTE* mem_node = (BYTE*)large_allocation + ZONE_HEADER_SIZE;
+    construct_large_node_header(mem_node, required_size);
+    large_allocation->last_allocated_node = mem_node;
+#ifdef PURGE_FREE_SPANS
+    /// pages of new mapping are never used
+    if (new_mapping) {
+        report_purged_memory(page_ceil(mem_node + NODE_HEADER_SIZE), mem_node + NODE_HEADER_SIZE + required_size);
+    }
+#endif
+
+    t_large_allocations_shard* shard = get_large_allocation_shard(large_allocation);
+    lock_acquire(&shard->lock);
+    add_zone_to_list(&shard->first_large_allocation, &shard->last_large_allocation, large_allocation);
+    lock_release(&shard->lock);
+    return (void*)(mem_node + NODE_HEADER_SIZE);
+}
+
+static BOOL shard_contains_large_allocation(t_large_allocations_shard* shard, t_zone* large_allocation) {
+    for (t_zone* zone = shard->first_large_allocation; zone != NULL; zone = zone->next) {
+        if (zone == large_allocation) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void release_large_allocation(t_zone* large_allocation) {
+#ifdef BUDDY_ALLOCATOR
+    if (large_allocation->buddy_region) {
+        buddy_release_zone(large_allocation);
+        return;
+    }
+#endif
+#ifdef LARGE_CACHE
+    if (put_zone_to_cache(large_allocation)) {
+        return;
+    }
+#endif
+    unmap_zone(large_allocation);
+}
+
+/// deallocate full large_allocation, unmap is done after shard lock is released.
+void large_free(BYTE* node) {
+    t_zone* large_allocation = (t_zone*)(node - ZONE_HEADER_SIZE);
+    t_large_allocations_shard* shard = get_large_allocation_shard(large_allocation);
+    lock_acquire(&shard->lock);
+    delete_zone_from_list(&shard->first_large_allocation, &shard->last_large_allocation, large_allocation);
+    lock_release(&shard->lock);
+    release_large_allocation(large_allocation);
+}
+
+#ifdef SAFE_FREE
+/// large_free of pointer found without locks: it's checked under shard lock before large allocation is read,
+/// so racing free of the same pointer doesn't touch unmapped memory. Returns FALSE if ptr isn't freed.
+BOOL large_free_user_memory(void* ptr) {
+    t_zone* large_allocation = (t_zone*)((BYTE*)ptr - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    t_large_allocations_shard* shard = get_large_allocation_shard(large_allocation);
+    lock_acquire(&shard->lock);
+    BOOL contains = shard_contains_large_allocation(shard, large_allocation);
+    if (contains) {
+        delete_zone_from_list(&shard->first_large_allocation, &shard->last_large_allocation, large_allocation);
+    }
+    lock_release(&shard->lock);
+    if (contains) {
+        release_large_allocation(large_allocation);
+    }
+    return contains;
+}
+#endif
+
+#ifdef LARGE_REMAP
+/// own mapping of large allocation is resized by kernel, if it can't grow in place its pages are moved
+/// to new address without copying. Zone leaves its shard while it's remapped, its address can change.
+/// Returns resized zone or NULL if mapping can't be resized, zone stays valid then.
+t_zone* large_remap(t_zone* large_allocation, size_t required_size) {
+    uint64_t mapping_size = get_zone_mapping_size(large_allocation);
+    uint64_t new_mapping_size = calculate_zone_size(Large, required_size);
+    t_large_allocations_shard* shard = get_large_allocation_shard(large_allocation);
+    lock_acquire(&shard->lock);
+    delete_zone_from_list(&shard->first_large_allocation, &shard->last_large_allocation, large_allocation);
+    lock_release(&shard->lock);
+#ifdef SAFE_FREE
+    page_map_clear(large_allocation);
+#endif
+
+    t_zone* new_large_allocation = (t_zone*)mremap((void*)large_allocation, mapping_size, new_mapping_size,
+                                                   MREMAP_MAYMOVE);
+    BOOL remapped = (void*)new_large_allocation != MAP_FAILED;
+    if (remapped) {
+        new_large_allocation->total_size = new_mapping_size - ZONE_HEADER_SIZE;
+        new_large_allocation->last_allocated_node = (BYTE*)new_large_allocation + ZONE_HEADER_SIZE;
+    }
+    else {
+        new_large_allocation = large_allocation;
+    }
+#ifdef SAFE_FREE
+    /// old pages have page map nodes already. If nodes for new pages can't be mapped, memory stays valid,
+    /// it just can't be freed with SAFE_FREE
+    page_map_set(new_large_allocation, Large);
+#endif
+
+    shard = get_large_allocation_shard(new_large_allocation);
+    lock_acquire(&shard->lock);
+    add_zone_to_list(&shard->first_large_allocation, &shard->last_large_allocation, new_large_allocation);
+    lock_release(&shard->lock);
+    return remapped ? new_large_allocation : NULL;
+}
+#endif
+
+#ifdef LARGE_TRIM
+/// zone is trimmed to the smallest mapping for required_size. Page map is set again for the rest of zone.
+void large_trim(t_zone* large_allocation, size_t required_size) {
+#ifdef BUDDY_ALLOCATOR
+    if (large_allocation->buddy_region) {
+        buddy_trim_zone(large_allocation, required_size);
+        return;
+    }
+#endif
+    uint64_t mapping_size = get_zone_mapping_size(large_allocation);
+    uint64_t new_mapping_size = calculate_zone_size(Large, required_size);
+    if (new_mapping_size + LARGE_TRIM_MIN_SIZE > mapping_size) {
+        return;
+    }
+#ifdef SAFE_FREE
+    page_map_clear(large_allocation);
+#endif
+    munmap((BYTE*)large_allocation + new_mapping_size, mapping_size - new_mapping_size);
+    large_allocation->total_size = new_mapping_size - ZONE_HEADER_SIZE;
+#ifdef SAFE_FREE
+    page_map_set(large_allocation, Large);
+#endif
+}
+#endif
+
+/// user memory of large allocation always starts right after zone and node headers,
+/// so only one shard is checked.
+BOOL large_allocations_contains_user_memory(void* ptr) {
+    t_zone* large_allocation = (t_zone*)((BYTE*)ptr - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    t_large_allocations_shard* shard = get_large_allocation_shard(large_allocation);
+    lock_acquire(&shard->lock);
+    BOOL contains = shard_contains_large_allocation(shard, large_allocation);
+    lock_release(&shard->lock);
+    return contains;
+}
+
+uint64_t large_allocations_number() {
+    uint64_t number = 0;
+    for (uint64_t i = 0; i < LARGE_ALLOCATIONS_SHARDS_COUNT; ++i) {
+        lock_acquire(&gLargeAllocations[i].lock);
+        for (t_zone* zone = gLargeAllocations[i].first_large_allocation; zone != NULL; zone = zone->next) {
+            ++number;
+        }
+        lock_release(&gLargeAllocations[i].lock);
+    }
+    return number;
+}
+
+/// lock isn't touched, it can be held by caller
+void clear_large_allocations() {
+    for (uint64_t i = 0; i < LARGE_ALLOCATIONS_SHARDS_COUNT; ++i) {
+#ifdef BUDDY_ALLOCATOR
+        /// buddy blocks are unmapped with their regions
+        t_zone* zone = gLargeAllocations[i].first_large_allocation;
+        while (zone != NULL) {
+            t_zone* next_zone = zone->next;
+            if (!zone->buddy_region) {
+                unmap_zone(zone);
+            }
+#ifdef SAFE_FREE
+            else {
+                page_map_clear(zone);
+            }
+#endif
+            zone = next_zone;
+        }
+#else
+        clear_zone_list(gLargeAllocations[i].first_large_allocation);
+#endif
+        gLargeAllocations[i].first_large_allocation = NULL;
+        gLargeAllocations[i].last_large_allocation = NULL;
+    }
+#ifdef BUDDY_ALLOCATOR
+    buddy_clear();
+#endif
+#ifdef LARGE_CACHE
+    clear_large_cache();
+#endif
+}
+
+void lock_large_allocations() {
+#ifdef BUDDY_ALLOCATOR
+    lock_buddy_allocators();
+#endif
+#ifdef LARGE_CACHE
+    lock_acquire(&gLargeCache.lock);
+#endif
+    for (uint64_t i = 0; i < LARGE_ALLOCATIONS_SHARDS_COUNT; ++i) {
+        lock_acquire(&gLargeAllocations[i].lock);
+    }
+}
+
+void unlock_large_allocations() {
+    for (uint64_t i = LARGE_ALLOCATIONS_SHARDS_COUNT; i > 0; --i) {
+        lock_release(&gLargeAllocations[i - 1].lock);
+    }
+#ifdef LARGE_CACHE
+    lock_release(&gLargeCache.lock);
+#endif
+#ifdef BUDDY_ALLOCATOR
+    unlock_buddy_allocators();
+#endif
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "lock.h"
+
+#ifdef RUNTIME_LOCK_ELISION
+int gMultiThreaded = 0;  /// sticky copy of !__libc_single_threaded
+#endif
+
+#ifdef LOCK_PROFILING
+t_lock_site_profile gLockProfile[LOCK_SITES_COUNT];
+int gLockProfilingEnabled = 0;
+ALLOCATOR_TLS t_lock_site tLockSite = LockSiteOther;
+
+static inline uint64_t now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + (uint64_t)time.tv_nsec;
+}
+
+static inline uint64_t wait_histogram_bucket(uint64_t wait_time_ns) {
+    uint64_t bucket = wait_time_ns ? 63 - (uint64_t)__builtin_clzll(wait_time_ns) : 0;
+    return bucket < LOCK_PROFILE_HISTOGRAM_SIZE ? bucket : LOCK_PROFILE_HISTOGRAM_SIZE - 1;
+}
+
+/// uncontended acquisition isn't timed, clock is read only if try acquire fails.
+void lock_acquire_profiled(t_lock* lock) {
+    t_lock_site_profile* profile = &gLockProfile[tLockSite];
+    __atomic_add_fetch(&profile->acquisitions, 1, __ATOMIC_RELAXED);
+    if (lock_try_acquire_now(lock)) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+    lock_acquire_now(lock);
+    uint64_t wait_time_ns = now_ns() - start;
+
+    __atomic_add_fetch(&profile->contended_acquisitions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&profile->wait_time_ns, wait_time_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&profile->wait_histogram[wait_histogram_bucket(wait_time_ns)], 1, __ATOMIC_RELAXED);
+}
+
+void __reset_lock_profile() {
+    memset(gLockProfile, 0, sizeof(gLockProfile));
+}
+
+void __print_lock_profile() {
+    static const char* site_names[LOCK_SITES_COUNT] = {"MALLOC", "FREE", "REALLOC", "CALLOC", "OTHER"};
+
+    printf("--------------------------------------------\n");
+    for (uint64_t site = 0; site < LOCK_SITES_COUNT; ++site) {
+        t_lock_site_profile* profile = &gLockProfile[site];
+        printf("%s : ACQUISITIONS %llu : CONTENDED %llu : WAIT NS %llu\n", site_names[site],
+               (unsigned long long)profile->acquisitions, (unsigned long long)profile->contended_acquisitions,
+               (unsigned long long)profile->wait_time_ns);
+        for (uint64_t i = 0; i < LOCK_PROFILE_HISTOGRAM_SIZE; ++i) {
+            if (profile->wait_histogram[i] != 0) {
+                printf("    %llu - %llu NS : %llu\n", 1ull << i, (1ull << (i + 1)) - 1,
+                       (unsigned long long)profile->wait_histogram[i]);
+            }
+        }
+    }
+    printf("--------------------------------------------\n");
+}
+#endif
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/// initial-exec model: dynamic TLS access can call malloc inside __tls_get_addr
+#define ALLOCATOR_TLS __thread __attribute__((tls_model("initial-exec")))
+
+/// Allocator lock. Without THREAD_SAFE all lock operations are no-op.
+typedef pthread_mutex_t t_lock;
+
+#define LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+static inline void lock_init(t_lock* lock) {
+    *lock = (t_lock)LOCK_INITIALIZER;
+}
+
+/// With RUNTIME_LOCK_ELISION locks are skipped while the process is single threaded.
+/// glibc (2.32+) clears __libc_single_threaded before the second thread is created by any of its entry points
+/// (pthread_create, thrd_create, internal helper threads), and thread creation is a synchronization point,
+/// so the new thread and the creating one both take locks from here on. Allocator never creates threads
+/// while it holds a lock, so no elided lock is released for real. The flag is copied to gMultiThreaded,
+/// so locks stay on even if glibc sets the flag back later. On other systems locks are always taken.
+#ifdef RUNTIME_LOCK_ELISION
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+#include <sys/single_threaded.h>
+#define USE_RUNTIME_LOCK_ELISION
+#endif
+
+extern int gMultiThreaded;
+#endif
+
+static inline int lock_is_needed() {
+#ifdef USE_RUNTIME_LOCK_ELISION
+    if (__atomic_load_n(&gMultiThreaded, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    if (__atomic_load_n(&__libc_single_threaded, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    __atomic_store_n(&gMultiThreaded, 1, __ATOMIC_RELAXED);
+    return 1;
+#else
+    return 1;
+#endif
+}
+
+/// Lock profiling (LOCK_PROFILING).
+///
+/// Every lock acquisition is counted for call site of the calling thread (public function it came from),
+/// contended acquisitions also record wait time into power of two histogram: bucket i counts waits
+/// in [2^i, 2^(i+1)) ns. Counting is turned on at runtime, disabled profiling costs one relaxed load.
+typedef enum e_lock_site {
+    LockSiteMalloc = 0,
+    LockSiteFree = 1,
+    LockSiteRealloc = 2,
+    LockSiteCalloc = 3,
+    LockSiteOther = 4,
+    LOCK_SITES_COUNT = 5
+} t_lock_site;
+
+#ifdef LOCK_PROFILING
+#define LOCK_PROFILE_HISTOGRAM_SIZE 32
+
+typedef struct s_lock_site_profile {
+    uint64_t acquisitions;
+    uint64_t contended_acquisitions;
+    uint64_t wait_time_ns;
+    uint64_t wait_histogram[LOCK_PROFILE_HISTOGRAM_SIZE];
+} t_lock_site_profile;
+
+extern t_lock_site_profile gLockProfile[LOCK_SITES_COUNT];
+extern int gLockProfilingEnabled;
+extern ALLOCATOR_TLS t_lock_site tLockSite;
+
+void lock_acquire_profiled(t_lock* lock);
+void __reset_lock_profile();
+void __print_lock_profile();
+#endif
+
+static inline void lock_set_site(t_lock_site site) {
+#ifdef LOCK_PROFILING
+    tLockSite = site;
+#else
+    (void)site;
+#endif
+}
+
+static inline void lock_acquire_now(t_lock* lock) {
+#ifdef THREAD_SAFE
+    pthread_mutex_lock(lock);
+#else
+    (void)lock;
+#endif
+}
+
+static inline int lock_try_acquire_now(t_lock* lock) {
+#ifdef THREAD_SAFE
+    return pthread_mutex_trylock(lock) == 0;
+#else
+    (void)lock;
+    return 1;
+#endif
+}
+
+static inline void lock_acquire(t_lock* lock) {
+    if (!lock_is_needed()) {
+        return;
+    }
+#ifdef LOCK_PROFILING
+    if (__atomic_load_n(&gLockProfilingEnabled, __ATOMIC_RELAXED)) {
+        lock_acquire_profiled(lock);
+        return;
+    }
+#endif
+    lock_acquire_now(lock);
+}
+
+/// returns TRUE if lock was taken.
+static inline int lock_try_acquire(t_lock* lock) {
+    if (!lock_is_needed()) {
+        return 1;
+    }
+    return lock_try_acquire_now(lock);
+}
+
+static inline void lock_release(t_lock* lock) {
+    if (!lock_is_needed()) {
+        return;
+    }
+#ifdef THREAD_SAFE
+    pthread_mutex_unlock(lock);
+#else
+    (void)lock;
+#endif
+}
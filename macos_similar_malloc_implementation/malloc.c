@@ -2,20 +2,30 @@
 #include "utilities.h"
 
 BOOL gInit = FALSE;
-t_memory_zones gMemoryZones;
+#ifdef FINE_GRAINED_LOCKS
+t_memory_zones gArenas[ARENAS_COUNT] = {[0 ... ARENAS_COUNT - 1] = {.lock = LOCK_INITIALIZER,
+                                                                  .class_locks = {[0 ... ZONE_CLASSES_COUNT - 1] = LOCK_INITIALIZER}}};
+#else
+t_memory_zones gArenas[ARENAS_COUNT] = {[0 ... ARENAS_COUNT - 1] = {.lock = LOCK_INITIALIZER}};
+#endif
 int gPageSize;
 
+/// only main arena gets default zones, other arenas create zones on first use.
 BOOL init() {
-    gInit = TRUE;
     gPageSize = getpagesize();
 
-    t_zone* tiny_default_zone = create_new_zone(calculate_zone_size(Tiny, 0));
+    t_zone* tiny_default_zone = create_new_zone(calculate_zone_size(Tiny, 0), Tiny, &gMemoryZones);
     gMemoryZones.first_tiny_zone = tiny_default_zone;
     gMemoryZones.last_tiny_zone = tiny_default_zone;
 
-    t_zone* small_default_zone = create_new_zone(calculate_zone_size(Small, 0));
+    t_zone* small_default_zone = create_new_zone(calculate_zone_size(Small, 0), Small, &gMemoryZones);
     gMemoryZones.first_small_zone = small_default_zone;
     gMemoryZones.last_small_zone = small_default_zone;
+#ifdef TINY_SLABS
+    /// without slab region tiny allocations just go to zones
+    slab_init();
+#endif
+    __atomic_store_n(&gInit, TRUE, __ATOMIC_RELEASE);
 
     if (!tiny_default_zone || !small_default_zone) {
         return FALSE;
@@ -24,6 +34,10 @@ BOOL init() {
 }
 
 void* __malloc(size_t required_size) {
+    return arena_malloc(&gMemoryZones, required_size);
+}
+
+void* arena_malloc(t_memory_zones* arena, size_t required_size) {
     if (!gInit) {
         if (!init()) {
             return NULL;
@@ -38,46 +52,76 @@ void* __malloc(size_t required_size) {
     required_size = required_size + 15 & ~15;
     t_allocation_type allocation_type = to_allocation_type(required_size);
 
+    /// large allocations don't touch arena, so arena lock isn't needed for them
     if (allocation_type == Large) {
-        t_zone* large_allocation = create_new_zone(calculate_zone_size(Large, required_size));
-        if (!large_allocation) {
-            return NULL;
-        }
+        return large_malloc(arena, required_size);
+    }
 
-        BYTE* mem_node = (BYTE*)large_allocation + ZONE_HEADER_SIZE;
-        construct_large_node_header(mem_node, required_size);
-        large_allocation->last_allocated_node = mem_node;
+#ifdef REMOTE_FREE
+    arena_drain_remote_frees(arena);
+#endif
+#ifdef DECAY
+    if (__atomic_add_fetch(&arena->decay_ticks, 1, __ATOMIC_RELAXED) % DECAY_TICKS_INTERVAL == 0) {
+        arena_decay(arena, decay_now());
+#ifdef REMOTE_FREE
+        drain_other_arenas_remote_frees(arena);
+#endif
+    }
+#endif
 
-        add_zone_to_list(&gMemoryZones.first_large_allocation, &gMemoryZones.last_large_allocation, large_allocation);
-        return (void*)(mem_node + NODE_HEADER_SIZE);
+#ifdef TINY_SLABS
+    if (allocation_type == Tiny) {
+        void* slot = slab_malloc(arena, required_size);
+        if (slot) {
+            return slot;
+        }
     }
+#endif
 
     t_zone** first_zone;
     t_zone** last_zone;
     uint64_t separate_size;
     switch (allocation_type) {
         case Tiny:
-            first_zone = &gMemoryZones.first_tiny_zone;
-            last_zone = &gMemoryZones.last_tiny_zone;
+            first_zone = &arena->first_tiny_zone;
+            last_zone = &arena->last_tiny_zone;
             separate_size = TINY_SEPARATE_SIZE;
             break;
         case Small:
-            first_zone = &gMemoryZones.first_small_zone;
-            last_zone = &gMemoryZones.last_small_zone;
+            first_zone = &arena->first_small_zone;
+            last_zone = &arena->last_small_zone;
             separate_size = SMALL_SEPARATE_SIZE;
             break;
+#ifdef MEDIUM_CLASS
+        case Medium:
+            first_zone = &arena->first_medium_zone;
+            last_zone = &arena->last_medium_zone;
+            separate_size = MEDIUM_SEPARATE_SIZE;
+            break;
+#endif
         case Large:
             exit(-1);
     }
 
+    class_lock_acquire(arena, allocation_type);
     void* memory = take_memory_from_zone_list(*first_zone, required_size, separate_size, allocation_type);
+#ifdef ZONE_STATE_LISTS
     if (!memory) {
-        t_zone* new_zone = create_new_zone(calculate_zone_size(allocation_type, required_size));
-        if (!new_zone) {
-            return NULL;
+        memory = take_memory_from_empty_zone(arena, required_size, separate_size, allocation_type);
+    }
+#endif
+    if (!memory) {
+        t_zone* new_zone = create_new_zone(calculate_zone_size(allocation_type, required_size), allocation_type, arena);
+        if (new_zone) {
+            memory = take_memory_from_zone_list(new_zone, required_size, separate_size, allocation_type);
+            add_zone_to_list(first_zone, last_zone, new_zone);
         }
-        memory = take_memory_from_zone_list(new_zone, required_size, separate_size, allocation_type);
-        add_zone_to_list(first_zone, last_zone, new_zone);
     }
+#ifdef ZONE_STATE_LISTS
+    if (memory) {
+        mark_zone_full_if_needed(get_node_zone((BYTE*)memory - NODE_HEADER_SIZE), allocation_type);
+    }
+#endif
+    class_lock_release(arena, allocation_type);
     return memory;
 }
@@ -1,13 +1,23 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include "lock.h"
+
+#ifdef __APPLE__
 #include <mach/vm_statistics.h>
+#else
+#define VM_MAKE_TAG(tag) (-1)  /// mmap tags are MacOS only, for anonymous mapping fd is -1
+#define VM_MEMORY_MALLOC 1
+#endif
 
 typedef struct s_memory_zones t_memory_zones;
 typedef struct s_zone t_zone;
+typedef struct s_slab_page t_slab_page;
+typedef struct s_buddy_region t_buddy_region;
 
 #define BYTE uint8_t
 
@@ -20,11 +30,52 @@ typedef struct s_zone t_zone;
 
 #define MINIMUM_SIZE_TO_ALLOCATE 16
 
+/// With ARENAS every thread works with one of ARENAS_COUNT independent arenas (see malloc_wrapper.c),
+/// without it there is only one arena.
+#ifdef ARENAS
+#ifndef ARENAS_COUNT
+#define ARENAS_COUNT 8
+#endif
+#else
+#undef ARENAS_COUNT
+#define ARENAS_COUNT 1
+#endif
+
 extern BOOL gInit;
-extern t_memory_zones gMemoryZones;
 extern int gPageSize;
 
-#define TINY_ZONE_SIZE 0x100000 /// 1 mb
+/// Advice for free pages which stay mapped, but are given back to system.
+#ifdef __APPLE__
+#define PURGE_PAGES_MADVISE MADV_FREE  /// pages keep old content until system takes them
+#else
+#define PURGE_PAGES_MADVISE MADV_DONTNEED
+#endif
+
+/// With HUGE_PAGES (Linux only, it needs transparent huge pages) zones are mapped HUGE_PAGE_SIZE aligned,
+/// sized in HUGE_PAGE_SIZE multiples and advised MADV_HUGEPAGE, so kernel can back them with huge pages
+/// and allocator paths take less TLB misses. Own mappings of large allocations get the same treatment
+/// from gHugePagesLargeMinSize mapping size (0 turns it off), buddy blocks keep usual pages.
+/// Huge page is resident as a whole, so RSS grows by partially used ones. Tiny zone is the only one
+/// smaller than huge page, it's 2 mb while gHugePagesZones is on. With gHugePagesZones off new zones are
+/// mapped and advised as usual, and new tiny zones are 1 mb again.
+#if defined(HUGE_PAGES) && !defined(__linux__)
+#undef HUGE_PAGES
+#endif
+#ifdef HUGE_PAGES
+#define HUGE_PAGE_SIZE 0x200000 /// 2 mb
+#ifndef HUGE_PAGES_LARGE_MIN_SIZE_DEFAULT
+#define HUGE_PAGES_LARGE_MIN_SIZE_DEFAULT 0x400000 /// 4 mb, at most a third of mapping is lost to rounding
+#endif
+
+extern BOOL gHugePagesZones;
+extern uint64_t gHugePagesLargeMinSize;
+#endif
+#define TINY_ZONE_DEFAULT_SIZE 0x100000 /// 1 mb
+#ifdef HUGE_PAGES
+#define TINY_ZONE_SIZE (__atomic_load_n(&gHugePagesZones, __ATOMIC_RELAXED) ? HUGE_PAGE_SIZE : TINY_ZONE_DEFAULT_SIZE)
+#else
+#define TINY_ZONE_SIZE TINY_ZONE_DEFAULT_SIZE
+#endif
 #define TINE_ALLOCATION_MAX_SIZE 128
 #define TINY_SEPARATE_SIZE TINE_ALLOCATION_MAX_SIZE / 2 + NODE_HEADER_SIZE
 
@@ -32,6 +83,19 @@ extern int gPageSize;
 #define SMALL_ALLOCATION_MAX_SIZE 512
 #define SMALL_SEPARATE_SIZE SMALL_ALLOCATION_MAX_SIZE / 2 + NODE_HEADER_SIZE
 
+/// With MEDIUM_CLASS sizes up to MEDIUM_ALLOCATION_MAX_SIZE are taken from medium zones instead of own mappings.
+/// Rest of split node smaller than the smallest medium node can't serve medium allocations, so it isn't separated.
+#ifdef MEDIUM_CLASS
+#define MEDIUM_ZONE_SIZE 0x800000 /// 8 mb, bigger zone doesn't fit 24 bit node offsets and TLSF first level
+#define MEDIUM_ALLOCATION_MAX_SIZE 0x10000 /// 64 kb
+#define MEDIUM_SEPARATE_SIZE (SMALL_ALLOCATION_MAX_SIZE + 16 + NODE_HEADER_SIZE)
+#define LARGE_ALLOCATION_MIN_SIZE (MEDIUM_ALLOCATION_MAX_SIZE + 1)
+#define ZONE_CLASSES_COUNT 3
+#else
+#define LARGE_ALLOCATION_MIN_SIZE (SMALL_ALLOCATION_MAX_SIZE + 1)
+#define ZONE_CLASSES_COUNT 2
+#endif
+
 /// We have 3 memory zones to optimize malloc speed and decrease mmap using.
 ///
 /// Tiny zone usable_size is 4 * getpagesize() (usually page usable_size is 4096 byte)
@@ -41,28 +105,137 @@ extern int gPageSize;
 /// and it conatains allocations with usable_size higher than tiny zone allocations and lower or equal
 /// to 16 * getpagesize() / 256
 ///
+/// With MEDIUM_CLASS medium zone is 8 mb, it contains allocations higher than small ones and lower or equal
+/// to 64 kb. Medium zones aren't preallocated.
+///
 /// Large allocations fully own their zones. And these zones aren't preallocated.
 /// Using for allocations with usable_size higher than 16 * getpagesize() / 256
+/// They don't belong to arena lists, they are tracked by gLargeAllocations (see below).
+///
+/// With ZONE_STATE_LISTS tiny and small lists hold only partially free zones. Zones which can't give even
+/// the smallest node of their class are kept in full lists, totally free zones in empty lists,
+/// so malloc looks only at zones which can serve it. Zone moves between lists on malloc, free and realloc.
+///
+/// All zones of one t_memory_zones (arena) are protected by its lock.
+/// With FINE_GRAINED_LOCKS arena lock is used only for init, every class zone list is protected by its class lock
+/// and nodes of every zone by zone lock (see locking helpers below).
 typedef struct s_memory_zones {
     t_zone* first_tiny_zone;
     t_zone* last_tiny_zone;  /// last ptr using for fast new_zone inserting
     t_zone* first_small_zone;
     t_zone* last_small_zone;
-    t_zone* first_large_allocation;
-    t_zone* last_large_allocation;
+#ifdef MEDIUM_CLASS
+    t_zone* first_medium_zone;
+    t_zone* last_medium_zone;
+#endif
+#ifdef ZONE_STATE_LISTS
+    t_zone* first_full_zones[ZONE_CLASSES_COUNT];  /// indexed by t_allocation_type
+    t_zone* last_full_zones[ZONE_CLASSES_COUNT];
+    t_zone* first_empty_zones[ZONE_CLASSES_COUNT];  /// the first one is taken when partial zones can't serve malloc
+    t_zone* last_empty_zones[ZONE_CLASSES_COUNT];
+#endif
+    t_lock lock;
+#ifdef FINE_GRAINED_LOCKS
+    t_lock class_locks[ZONE_CLASSES_COUNT];  /// indexed by t_allocation_type, large allocations don't need it
+#endif
+    BYTE* remote_free_nodes;  /// lock-free stack of nodes freed by other threads, drained under lock
+#ifdef DECAY
+    uint64_t decay_ticks;  /// arena_malloc calls counter, decay pass is run every DECAY_TICKS_INTERVAL calls
+#endif
+#ifdef TINY_SLABS
+    t_slab_page* slab_pages[TINE_ALLOCATION_MAX_SIZE / 16];  /// pages with free slots, one list per slot size
+    t_slab_page* empty_slab_pages;  /// pages without occupied slots, they can take any slot size
+#endif
 } t_memory_zones;
 
+extern t_memory_zones gArenas[ARENAS_COUNT];
+
+/// main arena, the only one without ARENAS.
+#define gMemoryZones (gArenas[0])
+
+/// With SEGREGATED_FREE_LISTS zone keeps free nodes in FREE_LISTS_COUNT lists by size instead of one list:
+/// sizes up to TINE_ALLOCATION_MAX_SIZE have list per 16 byte step, bigger ones list per power of two range.
+/// Non empty lists are marked in bitmap, so fitting list is found with one bit scan.
+#define FREE_LISTS_EXACT_COUNT (TINE_ALLOCATION_MAX_SIZE / 16)
+#define FREE_LISTS_COUNT (FREE_LISTS_EXACT_COUNT + 17)  /// last range starts at 2^23, it's enough for small zone
+#define FREE_LISTS_FIT_ATTEMPTS 4  /// nodes of power of two list checked before going to bigger list
+
+/// With DEFERRED_COALESCING freed node isn't merged with its neighbours right away, it's marked available
+/// and pushed to zone deferred list, so the same size malloc takes it back without split and merge.
+/// Deferred nodes are merged when zone can't give memory otherwise, or when their number reaches
+/// DEFERRED_COALESCING_MAX_NODES. The last allocated node is always released at once, so zone tail stays exact.
+#define DEFERRED_COALESCING_MAX_NODES 64
+
+/// With TLSF small zones keep free nodes in two-level segregated fit structure instead of zone free lists:
+/// first level splits sizes by power of two, second level splits every power of two range
+/// into TLSF_SL_COUNT lists. Sizes below TLSF_SMALL_SIZE go to first level 0 with 16 byte step.
+/// Non empty lists are marked in bitmaps, so both malloc and free take constant time.
+/// Control block is placed at the end of small (and medium) zone mapping, tiny zones keep usual free lists.
+#define TLSF_SL_COUNT_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_COUNT_LOG2)
+#define TLSF_SMALL_SIZE (TLSF_SL_COUNT * 16)
+#define TLSF_FL_SHIFT (TLSF_SL_COUNT_LOG2 + 4)
+#define TLSF_FL_COUNT 16  /// last first level list starts at 2^22, it's enough for small zone
+
+typedef struct s_tlsf {
+    BYTE* free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    uint32_t fl_bitmap;  /// bit i is set if any list of first level i isn't empty
+    uint32_t sl_bitmaps[TLSF_FL_COUNT];  /// bit j of sl_bitmaps[i] is set if free_lists[i][j] isn't empty
+} __attribute__((aligned(16))) t_tlsf;
+
+typedef enum s_zone_state {
+    ZonePartial = 0,
+    ZoneFull = 1,
+    ZoneEmpty = 2
+} t_zone_state;
+
 /// zone memory structure looking like this:
 /// [[zone_header]free_zone_space] <- zone after creating
 /// [[zone_header][[node_header]node_space]free_zone_space] <- zone with one allocated node
+/// zone header size is kept multiple of 16, otherwise nodes lose 16 byte alignment.
 typedef struct s_zone {
     struct s_zone* next;
     struct s_zone* prev;
+#ifdef SEGREGATED_FREE_LISTS
+    BYTE* free_lists[FREE_LISTS_COUNT];  /// first nodes of lists, index is given by to_free_list_index
+    uint32_t free_lists_bitmap;  /// bit i is set if free_lists[i] isn't empty
+#else
     BYTE* first_free_node;
     BYTE* last_free_node;  /// using for fast inserting
+#endif
     BYTE* last_allocated_node;
     uint64_t total_size;
-} t_zone;
+    uint64_t largest_free_size;  /// free node size upper bound, zone summary (see zone_may_fit)
+    uint64_t tail_size;  /// not marked memory after last allocated node, zone summary
+    t_memory_zones* arena;  /// arena which zone belongs to, using to find it on free
+#ifdef TLSF
+    t_tlsf* tlsf;  /// free nodes of small and medium zone, NULL for tiny zone
+#endif
+#ifdef DEFERRED_COALESCING
+    BYTE* first_deferred_node;  /// freed nodes which aren't merged with neighbours yet, LIFO
+    uint64_t deferred_nodes_number;
+    uint64_t deferred_largest_size;  /// the biggest size deferred node can get after merging with neighbours
+#endif
+#if defined(DECAY) || defined(LARGE_CACHE)
+    uint64_t free_since;  /// ms when zone became totally free, 0 if it's used, DECAY_PURGED if pages are given back
+#endif
+#ifdef PURGE_FREE_SPANS
+    BYTE* purged_tail;  /// whole tail pages from it are purged or never used, see update_zone_tail_size
+    uint64_t dirty_size;  /// memory freed since the last purge pass
+#endif
+#ifdef ZONE_STATE_LISTS
+    t_zone_state state;  /// list zone is kept in, changed under class and zone locks
+#ifdef FINE_GRAINED_LOCKS
+    uint32_t pending_refreshes;  /// refresh_zone_state calls to come, zone isn't unmapped before them
+#endif
+#endif
+#ifdef FINE_GRAINED_LOCKS
+    t_lock lock;
+#endif
+#ifdef BUDDY_ALLOCATOR
+    t_buddy_region* buddy_region;  /// region of large zone taken from buddy allocator, NULL for own mapping
+#endif
+} __attribute__((aligned(16))) t_zone;
 
 /// for memory optimization memory_node header doesn't have structure and we work with it using bit operations.
 /// memory_node header size is 16 byte for all types (tiny, small, large).
@@ -75,9 +248,11 @@ typedef struct s_zone {
  * 24_bit offset_from_zone_start;
  * 24_bit prev_free_node_offset_from_zone_start;
  * 24_bit next_free_node_offset_from_zone_start;
+ * 1_bit  purged; (whole pages of free node user memory are given back, PURGE_FREE_SPANS)
+ * 1_bit  deferred; (free node isn't merged yet, DEFERRED_COALESCING)
  * 1_bit  not_used_memory;
  * 1_bit  available;
- * 2_bit  node_type; (tiny/small/large)
+ * 2_bit  node_type; (tiny/small/medium/large)
  * ---- end of 128 byte
 }
  */
@@ -87,14 +262,20 @@ typedef struct s_zone {
  * large_memory_node {
  * 64_bit size
  * 62_bit not_used_memory;
- * 2_bit  node_type; (tiny/small/large)
+ * 2_bit  node_type; (tiny/small/medium/large)
  * }
  */
 
+/// classes are ordered by size, zone classes go before Large.
 typedef enum s_allocation_type {
     Tiny = 0,
     Small = 1,
+#ifdef MEDIUM_CLASS
+    Medium = 2,
+    Large = 3
+#else
     Large = 2
+#endif
 } t_allocation_type;
 
 typedef struct s_node_representation {
@@ -116,7 +297,235 @@ typedef struct s_large_node_representation {
     t_allocation_type type;
 } t_large_node_representation;
 
+/// Locking helpers.
+///
+/// Callers of arena_malloc, free_user_memory and __realloc hold arena lock taken with arena_lock_acquire.
+/// With FINE_GRAINED_LOCKS it's no-op, and these functions lock by themselves in order class lock -> zone lock:
+/// malloc holds class lock for the whole zone list walk and locks every zone it takes memory from,
+/// free locks only node zone and takes class lock when zone has to be removed from list.
+/// arena_lock_all_acquire locks everything that protects arena zone lists in both modes.
+static inline void arena_lock_acquire(t_memory_zones* arena) {
+#ifdef FINE_GRAINED_LOCKS
+    (void)arena;
+#else
+    lock_acquire(&arena->lock);
+#endif
+}
+
+static inline void arena_lock_release(t_memory_zones* arena) {
+#ifdef FINE_GRAINED_LOCKS
+    (void)arena;
+#else
+    lock_release(&arena->lock);
+#endif
+}
+
+static inline BOOL arena_lock_try_acquire(t_memory_zones* arena) {
+#ifdef FINE_GRAINED_LOCKS
+    (void)arena;
+    return TRUE;
+#else
+    return lock_try_acquire(&arena->lock);
+#endif
+}
+
+static inline void arena_lock_all_acquire(t_memory_zones* arena) {
+#ifdef FINE_GRAINED_LOCKS
+    for (uint64_t i = 0; i < ZONE_CLASSES_COUNT; ++i) {
+        lock_acquire(&arena->class_locks[i]);
+    }
+#else
+    lock_acquire(&arena->lock);
+#endif
+}
+
+static inline void arena_lock_all_release(t_memory_zones* arena) {
+#ifdef FINE_GRAINED_LOCKS
+    for (uint64_t i = ZONE_CLASSES_COUNT; i > 0; --i) {
+        lock_release(&arena->class_locks[i - 1]);
+    }
+#else
+    lock_release(&arena->lock);
+#endif
+}
+
+static inline void class_lock_acquire(t_memory_zones* arena, t_allocation_type type) {
+#ifdef FINE_GRAINED_LOCKS
+    lock_acquire(&arena->class_locks[type]);
+#else
+    (void)arena;
+    (void)type;
+#endif
+}
+
+static inline void class_lock_release(t_memory_zones* arena, t_allocation_type type) {
+#ifdef FINE_GRAINED_LOCKS
+    lock_release(&arena->class_locks[type]);
+#else
+    (void)arena;
+    (void)type;
+#endif
+}
+
+static inline void zone_lock_acquire(t_zone* zone) {
+#ifdef FINE_GRAINED_LOCKS
+    lock_acquire(&zone->lock);
+#else
+    (void)zone;
+#endif
+}
+
+static inline void zone_lock_release(t_zone* zone) {
+#ifdef FINE_GRAINED_LOCKS
+    lock_release(&zone->lock);
+#else
+    (void)zone;
+#endif
+}
+
+/// Registry of large allocations, needed only for dumps, free_all and SAFE_FREE.
+/// Large allocation is placed to shard by its address, shards are protected by their own locks,
+/// and mmap/munmap are done outside of any lock, so large malloc/free don't block arenas.
+#define LARGE_ALLOCATIONS_SHARDS_COUNT_LOG2 4
+#define LARGE_ALLOCATIONS_SHARDS_COUNT (1 << LARGE_ALLOCATIONS_SHARDS_COUNT_LOG2)
+
+typedef struct s_large_allocations_shard {
+    t_zone* first_large_allocation;
+    t_zone* last_large_allocation;
+    t_lock lock;
+} t_large_allocations_shard;
+
+extern t_large_allocations_shard gLargeAllocations[LARGE_ALLOCATIONS_SHARDS_COUNT];
+
+/// Mappings can be aligned much more than to page (buddy blocks to 64 kb, huge page mappings to 2 mb),
+/// so low bits of page number are often the same. Page number is mixed (splitmix64 finalizer),
+/// and the top bits are taken, they depend on all bits of page number.
+static inline uint64_t to_large_allocations_shard_index(t_zone* large_allocation) {
+    uint64_t page = (uint64_t)large_allocation >> 12;
+    page = (page ^ (page >> 30)) * 0xBF58476D1CE4E5B9ull;
+    page = (page ^ (page >> 27)) * 0x94D049BB133111EBull;
+    return (page ^ (page >> 31)) >> (64 - LARGE_ALLOCATIONS_SHARDS_COUNT_LOG2);
+}
+
+void* large_malloc(t_memory_zones* arena, size_t required_size);
+void large_free(BYTE* node);
+#ifdef SAFE_FREE
+BOOL large_free_user_memory(void* ptr);
+#endif
+BOOL large_allocations_contains_user_memory(void* ptr);
+uint64_t large_allocations_number();
+void clear_large_allocations();
+void lock_large_allocations();
+void unlock_large_allocations();
+
+/// With LARGE_REMAP (Linux only, it needs mremap) realloc resizes own mapping of large allocation
+/// instead of malloc, copy and free. Mapping grows when user memory from LARGE_REMAP_MIN_SIZE doesn't fit it,
+/// and shrinks when the new one takes less than half of it. Buddy blocks are reallocated as usual.
+#if defined(LARGE_REMAP) && !defined(__linux__)
+#undef LARGE_REMAP
+#endif
+#ifdef LARGE_REMAP
+#define LARGE_REMAP_MIN_SIZE 0x20000 /// 128 kb, smaller memory is copied faster than remapped
+
+t_zone* large_remap(t_zone* large_allocation, size_t required_size);
+#endif
+
+/// With LARGE_TRIM realloc which shrinks large allocation gives back whole pages after its new end,
+/// if there are at least LARGE_TRIM_MIN_SIZE of them. Own mapping tail is unmapped,
+/// unneeded upper halves of buddy block go back to free lists with their pages purged.
+#ifdef LARGE_TRIM
+#define LARGE_TRIM_MIN_SIZE 0x10000 /// 64 kb
+
+void large_trim(t_zone* large_allocation, size_t required_size);
+#endif
+
+/// Large mappings cache (LARGE_CACHE).
+///
+/// Freed large zone with own mapping isn't unmapped, it's kept in cache bucket by its mapping size
+/// (bucket i holds mappings of [2^i, 2^(i+1)) pages), so next large malloc takes it with pages already faulted in.
+/// Mapping is reused for requests from half of its size to its size, the most recently cached one is tried first.
+/// Cache holds at most gLargeCacheMaxBytes, the oldest mappings of the biggest buckets are unmapped
+/// to fit it. Mappings cached longer than gLargeCacheDecayTimeMs are unmapped on next large malloc or free.
+/// Cache is protected by its own lock, munmap is done outside of it.
+#ifdef LARGE_CACHE
+#define LARGE_CACHE_BUCKETS_COUNT 20
+#define LARGE_CACHE_FIT_ATTEMPTS 8  /// mappings of bucket checked before going to next bucket
+#ifndef LARGE_CACHE_MAX_BYTES_DEFAULT
+#define LARGE_CACHE_MAX_BYTES_DEFAULT 0x4000000 /// 64 mb
+#endif
+#ifndef LARGE_CACHE_DECAY_TIME_DEFAULT_MS
+#define LARGE_CACHE_DECAY_TIME_DEFAULT_MS 1000
+#endif
+
+typedef struct s_large_cache {
+    t_zone* first_zones[LARGE_CACHE_BUCKETS_COUNT];  /// the oldest mapping of bucket
+    t_zone* last_zones[LARGE_CACHE_BUCKETS_COUNT];  /// the most recently cached mapping of bucket
+    uint64_t bytes;
+    t_lock lock;
+} t_large_cache;
+
+extern t_large_cache gLargeCache;
+extern uint64_t gLargeCacheMaxBytes;
+extern uint64_t gLargeCacheDecayTimeMs;
+
+void clear_large_cache();
+#endif
+
+/// Buddy allocator (BUDDY_ALLOCATOR).
+///
+/// Large allocations from BUDDY_MIN_ALLOCATION_SIZE to BUDDY_MAX_ALLOCATION_SIZE don't get own mappings,
+/// their zones are blocks of 2^order pages cut from BUDDY_REGION_SIZE regions. Region is aligned to its size,
+/// so block region is found by address, and its metadata (order of every block start page) takes its first block.
+/// Taken block is split in halves down to required order, freed block is merged with its buddy while buddy is free,
+/// both are O(log n). Free blocks of all arena regions are kept in lists by order, non empty lists are marked
+/// in bitmap. Block is a usual large zone for the rest of allocator, it's registered in gLargeAllocations.
+/// Totally free region is unmapped, except BUDDY_MAX_EMPTY_REGIONS ones kept for next allocations.
+/// Every arena has its own buddy allocator with its own lock, arena lock isn't needed.
+#ifdef BUDDY_ALLOCATOR
+#define BUDDY_PAGE_SIZE 4096
+#define BUDDY_REGION_ORDER 12
+#define BUDDY_REGION_SIZE (BUDDY_PAGE_SIZE << BUDDY_REGION_ORDER) /// 16 mb
+#define BUDDY_REGION_PAGES_COUNT (1 << BUDDY_REGION_ORDER)
+#define BUDDY_MIN_ALLOCATION_SIZE 0x10000 /// 64 kb
+#define BUDDY_MAX_ALLOCATION_SIZE 0x400000 /// 4 mb, with headers it takes block of 8 mb
+#define BUDDY_MAX_EMPTY_REGIONS 1
+#define BUDDY_PAGE_FREE 0x80  /// set in page order of free block start page
+
+typedef struct s_buddy_block {
+    struct s_buddy_block* next;
+    struct s_buddy_block* prev;
+} t_buddy_block;  /// free block, links are kept in its memory
+
+typedef struct s_buddy_allocator {
+    t_buddy_block* free_blocks[BUDDY_REGION_ORDER];  /// indexed by order, region sized block is never free
+    uint32_t free_blocks_bitmap;  /// bit i is set if free_blocks[i] isn't empty
+    t_buddy_region* first_region;
+    uint64_t empty_regions_number;
+    t_lock lock;
+} t_buddy_allocator;
+
+typedef struct s_buddy_region {
+    struct s_buddy_region* next;
+    struct s_buddy_region* prev;
+    t_buddy_allocator* allocator;
+    uint64_t free_pages_number;
+    BYTE page_orders[BUDDY_REGION_PAGES_COUNT];  /// valid for block start pages only
+} t_buddy_region;
+
+extern t_buddy_allocator gBuddyAllocators[ARENAS_COUNT];  /// indexed like gArenas
+
+t_zone* buddy_create_zone(t_memory_zones* arena, uint64_t required_size);
+void buddy_release_zone(t_zone* zone);
+#ifdef LARGE_TRIM
+void buddy_trim_zone(t_zone* zone, uint64_t required_size);
+#endif
+void buddy_clear();
+void lock_buddy_allocators();
+void unlock_buddy_allocators();
+#endif
+
 BOOL init();
+void* arena_malloc(t_memory_zones* arena, size_t required_size);
 
 void* take_memory_from_zone_list(t_zone* first_zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type);
 void* take_memory_from_zone(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type);
@@ -124,11 +533,206 @@ void* take_memory_from_free_nodes(t_zone* zone, uint64_t required_size, uint64_t
 void take_away_node_part_and_make_it_available(BYTE* first_node, uint64_t first_node_new_size, t_zone* zone, t_allocation_type type);
 BOOL reallocate_memory_in_zone(BYTE* raw_node, uint64_t new_size, uint64_t separate_size);
 
-t_zone* create_new_zone(size_t size);
+t_zone* create_new_zone(size_t size, t_allocation_type type, t_memory_zones* arena);
+BOOL construct_zone_header(t_zone* new_zone, size_t size, t_allocation_type type, t_memory_zones* arena);
+void unmap_zone(t_zone* zone);
 
 void free_memory_in_zone_list(t_zone** first_zone, t_zone**last_zone, BYTE* node);
 void clear_zone_list(t_zone* current_zone);
 
+#ifdef ZONE_STATE_LISTS
+void* take_memory_from_empty_zone(t_memory_zones* arena, uint64_t required_size, uint64_t separate_size,
+                                  t_allocation_type type);
+void mark_zone_full_if_needed(t_zone* zone, t_allocation_type type);
+void refresh_zone_state(t_memory_zones* arena, t_zone* zone, t_allocation_type type);
+#endif
+
+#if defined(DECAY) || defined(LARGE_CACHE)
+uint64_t decay_now();  /// monotonic time in ms
+#endif
+
+/// Decay (DECAY).
+///
+/// Totally free zone isn't unmapped on free, it's kept in its list and can be taken by next malloc.
+/// If it stays free longer than gDecayTimeMs, decay pass unmaps it, or gives its pages back with madvise
+/// if it's the only zone of its list. Pass is run from arena_malloc every DECAY_TICKS_INTERVAL calls
+/// and unmaps at most DECAY_MAX_ZONES_PER_PASS zones of every list, so memory goes back gradually.
+#ifdef DECAY
+#ifndef DECAY_TIME_DEFAULT_MS
+#define DECAY_TIME_DEFAULT_MS 10000
+#endif
+#define DECAY_TICKS_INTERVAL 1024
+#define DECAY_MAX_ZONES_PER_PASS 4
+#define DECAY_PURGED UINT64_MAX
+
+extern uint64_t gDecayTimeMs;
+
+void arena_decay(t_memory_zones* arena, uint64_t now);
+#endif
+
+/// Free spans purge (PURGE_FREE_SPANS).
+///
+/// Zone with a few live nodes isn't unmapped, so without purge its free memory stays resident forever.
+/// Purge pass gives back whole pages of free node user memory and of zone tail with madvise, node headers are kept.
+/// Pass walks zone nodes when memory freed in zone since the last pass reaches 1/PURGE_DIRTY_RATIO of zone,
+/// only spans with at least PURGE_MIN_SIZE of not purged pages are given back, so refaults after reuse
+/// are paid at most once per pass. Purged node is marked in its header, node split from it keeps the mark,
+/// node merged with it keeps the mark if freed memory doesn't cover any of its whole pages.
+/// On Linux purged pages are read as zeroes, memory taken from them is reported in tPurgedMemory
+/// and calloc zeroes only the rest.
+#ifdef PURGE_FREE_SPANS
+#ifndef PURGE_MIN_SIZE
+#define PURGE_MIN_SIZE 0x10000 /// 64 kb
+#endif
+#define PURGE_DIRTY_RATIO 8
+
+#ifndef __APPLE__
+#define PURGED_MEMORY_IS_ZEROED  /// PURGE_PAGES_MADVISE drops pages, they are zero filled on next touch
+#endif
+
+typedef struct s_purged_memory {
+    BYTE* start;  /// NULL if the last zone malloc of thread didn't take purged pages
+    BYTE* end;
+} t_purged_memory;
+
+extern ALLOCATOR_TLS t_purged_memory tPurgedMemory;
+
+void purge_free_spans(t_zone* zone);
+#endif
+
+/// Tiny slabs (TINY_SLABS).
+///
+/// Tiny allocations are taken from slab pages instead of zones, they don't have node header.
+/// Every page holds slots of one size (16 byte step up to TINE_ALLOCATION_MAX_SIZE), free slots are marked
+/// in page bitmap. Pages are cut from one region reserved on init, so slab memory is recognized by address,
+/// and page metadata is kept in array at region start, indexed by page number.
+/// Pages are protected like tiny zones: by arena lock, or by tiny class lock with FINE_GRAINED_LOCKS.
+/// If region is exhausted, tiny allocations go to zones as usual.
+/// Memory of empty page is given back with madvise: by decay pass with DECAY, right away otherwise
+/// if arena already keeps another empty page.
+#ifdef TINY_SLABS
+#ifndef SLAB_REGION_SIZE
+#define SLAB_REGION_SIZE 0x10000000 /// 256 mb
+#endif
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_PAGES_COUNT (SLAB_REGION_SIZE / SLAB_PAGE_SIZE)
+#define SLAB_BITMAP_WORDS (SLAB_PAGE_SIZE / 16 / 64)
+
+typedef struct s_slab_page {
+    uint64_t free_slots[SLAB_BITMAP_WORDS];  /// bit is set for free slot
+    struct s_slab_page* prev;
+    struct s_slab_page* next;
+    t_memory_zones* arena;  /// set when page is cut from region, page never moves to other arena
+    uint32_t slot_size;  /// 0 for empty page
+    uint32_t free_slots_number;
+#ifdef DECAY
+    uint64_t free_since;  /// ms when page became empty, DECAY_PURGED if its memory is given back
+#endif
+} t_slab_page;
+
+extern BYTE* gSlabRegion;
+extern t_slab_page* gSlabPages;
+extern uint64_t gSlabPagesUsed;
+
+BOOL slab_init();
+void slab_clear();
+void* slab_malloc(t_memory_zones* arena, uint64_t required_size);
+void slab_free(void* ptr);
+BOOL slab_contains_user_memory(void* ptr);
+#ifdef DECAY
+void slab_decay(t_memory_zones* arena, uint64_t now);
+#endif
+#endif
+
+/// Page map (SAFE_FREE).
+///
+/// Radix tree from page address to zone which owns the page and its allocation type,
+/// so pointer validation doesn't walk zone lists. Every zone page is set on create_new_zone and cleared
+/// in unmap_zone. Key is address >> PAGE_MAP_PAGE_SHIFT split to PAGE_MAP_LEVELS indexes,
+/// root is static, middle nodes and leaves are mapped on first use and never unmapped.
+/// Leaf entry is zone address with allocation type and arena index in low bits, zones are page aligned,
+/// so lookup doesn't read zone memory: zone can be unmapped meanwhile by racing free of the same pointer.
+#ifdef SAFE_FREE
+#define PAGE_MAP_PAGE_SHIFT 12  /// 4096, mmap granularity on every supported system is multiple of it
+#define PAGE_MAP_LEVELS 3
+#define PAGE_MAP_LEVEL_BITS 12  /// 48 bit addresses
+#define PAGE_MAP_NODE_SIZE (1ull << PAGE_MAP_LEVEL_BITS)
+#define PAGE_MAP_TYPE_MASK 0x3ull
+#define PAGE_MAP_ARENA_SHIFT 2
+#define PAGE_MAP_ARENA_MASK 0xFFCull
+#if ARENAS_COUNT > (PAGE_MAP_ARENA_MASK >> PAGE_MAP_ARENA_SHIFT) + 1
+#error "arena index doesn't fit to page map entry"
+#endif
+
+BOOL page_map_set(t_zone* zone, t_allocation_type type);
+void page_map_clear(t_zone* zone);
+t_zone* page_map_get(void* ptr, t_allocation_type* type, t_memory_zones** arena);
+#endif
+
+BOOL arena_contains_user_memory(t_memory_zones* arena, void* ptr);
+BOOL zones_contains_user_memory(void* ptr);
+t_memory_zones* find_user_memory_arena(void* ptr, t_allocation_type* type);
+
+/// Per-thread cache of freed tiny and small nodes.
+///
+/// Every bin keeps nodes of one 16 byte size step (bin i holds nodes with size (i + 1) * 16)
+/// in a singly linked list threaded through node user memory, so take and put don't touch zones at all.
+/// Bins are refilled from zones and flushed back to them in batches of THREAD_CACHE_BATCH_SIZE nodes,
+/// that's the only part which takes arena locks.
+#define THREAD_CACHE_BINS_COUNT (SMALL_ALLOCATION_MAX_SIZE / 16)
+#define THREAD_CACHE_BIN_CAPACITY 32
+#define THREAD_CACHE_BATCH_SIZE (THREAD_CACHE_BIN_CAPACITY / 2)
+
+typedef struct s_thread_cache_bin {
+    BYTE* first_node;
+    uint64_t nodes_number;
+} t_thread_cache_bin;
+
+typedef struct s_thread_cache {
+    t_thread_cache_bin bins[THREAD_CACHE_BINS_COUNT];
+    uint64_t generation;  /// cache is dropped if it differs from gThreadCacheGeneration (free_all was called)
+} t_thread_cache;
+
+extern uint64_t gThreadCacheGeneration;
+
+void* thread_cache_take(t_thread_cache* cache, size_t required_size);
+BOOL thread_cache_put(t_thread_cache* cache, void* ptr);
+void* thread_cache_refill(t_thread_cache* cache, t_memory_zones* arena, size_t required_size);
+void thread_cache_release(t_thread_cache* cache, void* ptr);
+void thread_cache_flush(t_thread_cache* cache);
+
+/// Deferred free rings (DEFERRED_FREE, see malloc_wrapper.c).
+///
+/// Thread with deferred free enabled doesn't free memory itself, it pushes pointers to its ring,
+/// and reclaimer thread frees them later. Ring is single producer (owner thread) single consumer (reclaimer),
+/// it's bounded both by pointers number and by memory held, push fails when any bound is reached.
+/// Rings are never unmapped, ring of exited thread is reused by next one.
+#define DEFERRED_FREE_RING_CAPACITY 1024
+#define DEFERRED_FREE_RING_MAX_BYTES (4 * 1024 * 1024)
+
+typedef struct s_deferred_free_ring {
+    void* slots[DEFERRED_FREE_RING_CAPACITY];
+    uint64_t head;  /// next slot to pop, changed only by reclaimer
+    uint64_t tail;  /// next slot to push, changed only by owner
+    uint64_t bytes;  /// user memory held by pushed pointers
+    BOOL in_use;  /// ring has owner thread
+    struct s_deferred_free_ring* next;
+} t_deferred_free_ring;
+
+extern t_deferred_free_ring* gDeferredFreeRings;
+
+t_deferred_free_ring* deferred_free_ring_acquire();
+void deferred_free_ring_release(t_deferred_free_ring* ring);
+BOOL deferred_free_push(t_deferred_free_ring* ring, void* ptr);
+void* deferred_free_pop(t_deferred_free_ring* ring);
+uint64_t deferred_free_ring_size(t_deferred_free_ring* ring);
+
+void free_user_memory(void* ptr);
+
+void arena_push_remote_free(t_memory_zones* arena, void* ptr);
+void arena_drain_remote_frees(t_memory_zones* arena);
+void drain_other_arenas_remote_frees(t_memory_zones* current_arena);
+
 /// for gtest
 void __free(void* ptr);
 void* __malloc(size_t required_size);
@@ -29,51 +29,121 @@ static inline void print_zone_mem(t_zone *zone, uint64_t *total_by_user) {
     *total_by_user += node_representation.size;
 }
 
-void __print_alloc_mem() {
-    uint32_t i;
-    uint64_t total_for_user = 0;
-    uint64_t total_by_fact = 0;
+static void print_large_allocations_mem(uint64_t *total_for_user, uint64_t *total_by_fact) {
+    uint32_t i = 0;
+    for (uint32_t shard = 0; shard < LARGE_ALLOCATIONS_SHARDS_COUNT; ++shard) {
+        for (t_zone *zone = gLargeAllocations[shard].first_large_allocation; zone != NULL; zone = zone->next) {
+            printf("LARGE ZONE %d : %p : %llu\n", i, zone, zone->total_size);
+            ++i;
+            t_large_node_representation large_node = get_large_node_representation((BYTE *) zone + ZONE_HEADER_SIZE);
+            printf("MEM NODE : %p : %llu\n", large_node.raw_node + NODE_HEADER_SIZE, large_node.size);
+            printf("\n");
 
-    printf("--------------------------------------------\n");
-    i = 0;
-    for (t_zone *zone = gMemoryZones.first_tiny_zone; zone != NULL; zone = zone->next) {
-        total_by_fact += zone->total_size + ZONE_HEADER_SIZE;
+            *total_for_user += large_node.size;
+            *total_by_fact += zone->total_size + ZONE_HEADER_SIZE;
+        }
+    }
+}
 
-        printf("TINY ZONE %d : %p : %llu\n", i, zone, zone->total_size);
-        ++i;
-        if (zone->last_allocated_node == NULL) {
-            printf("\n");
+#ifdef TINY_SLABS
+static inline uint64_t slab_pages_used() {
+    uint64_t pages_used = __atomic_load_n(&gSlabPagesUsed, __ATOMIC_RELAXED);
+    return pages_used < SLAB_PAGES_COUNT ? pages_used : SLAB_PAGES_COUNT;
+}
+
+static inline BOOL slab_slot_occupied(t_slab_page *page, uint64_t slot) {
+    return (page->free_slots[slot / 64] & (1ull << (slot % 64))) == 0;
+}
+
+/// slab pages are protected by locks taken with arena_lock_all_acquire, caller holds them.
+/// Empty pages aren't shown, but they are counted as taken memory.
+static void print_arena_slab_mem(t_memory_zones *arena, uint64_t *total_for_user, uint64_t *total_by_fact) {
+    uint32_t i = 0;
+    for (uint64_t page_index = 0; gSlabRegion != NULL && page_index < slab_pages_used(); ++page_index) {
+        t_slab_page *page = &gSlabPages[page_index];
+        if (page->arena != arena) {
+            continue;
+        }
+        *total_by_fact += SLAB_PAGE_SIZE;
+        if (page->slot_size == 0) {
             continue;
         }
-        print_zone_mem(zone, &total_for_user);
+
+        BYTE *page_memory = get_slab_page_memory(page);
+        printf("TINY SLAB PAGE %d : %p : %u\n", i, page_memory, page->slot_size);
+        ++i;
+        uint32_t j = 0;
+        for (uint64_t slot = 0; slot < SLAB_PAGE_SIZE / page->slot_size; ++slot) {
+            if (slab_slot_occupied(page, slot)) {
+                BYTE *mem = page_memory + slot * page->slot_size;
+                printf("MEM SLOT %d : %p - %p : %u : OCCUPIED\n", j, mem, mem + page->slot_size, page->slot_size);
+                ++j;
+                *total_for_user += page->slot_size;
+            }
+        }
         printf("\n");
     }
+}
+#endif
 
-    i = 0;
-    for (t_zone *zone = gMemoryZones.first_small_zone; zone != NULL; zone = zone->next) {
-        total_by_fact += zone->total_size + ZONE_HEADER_SIZE;
+static void print_zone_list_mem(t_zone *zone, const char *name, uint32_t *i, uint64_t *total_for_user,
+                                uint64_t *total_by_fact) {
+    for (; zone != NULL; zone = zone->next) {
+        *total_by_fact += get_zone_mapping_size(zone);
 
-        printf("SMALL ZONE %d : %p : %llu\n", i, zone, zone->total_size);
-        ++i;
-        if (zone->last_allocated_node == NULL) {
-            printf("\n");
-            continue;
+        printf("%s ZONE %d : %p : %llu\n", name, *i, zone, zone->total_size);
+        ++*i;
+        zone_lock_acquire(zone);
+        if (zone->last_allocated_node != NULL) {
+            print_zone_mem(zone, total_for_user);
         }
-        print_zone_mem(zone, &total_for_user);
+        zone_lock_release(zone);
         printf("\n");
     }
+}
 
+static void print_arena_mem(t_memory_zones *arena, uint64_t *total_for_user, uint64_t *total_by_fact) {
+    uint32_t i;
+
+#ifdef TINY_SLABS
+    print_arena_slab_mem(arena, total_for_user, total_by_fact);
+#endif
     i = 0;
-    for (t_zone *zone = gMemoryZones.first_large_allocation; zone != NULL; zone = zone->next) {
-        printf("LARGE ZONE %d : %p : %llu\n", i, zone, zone->total_size);
-        ++i;
-        t_large_node_representation large_node = get_large_node_representation((BYTE *) zone + ZONE_HEADER_SIZE);
-        printf("MEM NODE : %p : %llu\n", large_node.raw_node + NODE_HEADER_SIZE, large_node.size);
-        printf("\n");
+    print_zone_list_mem(arena->first_tiny_zone, "TINY", &i, total_for_user, total_by_fact);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_mem(arena->first_full_zones[Tiny], "TINY", &i, total_for_user, total_by_fact);
+    print_zone_list_mem(arena->first_empty_zones[Tiny], "TINY", &i, total_for_user, total_by_fact);
+#endif
+
+    i = 0;
+    print_zone_list_mem(arena->first_small_zone, "SMALL", &i, total_for_user, total_by_fact);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_mem(arena->first_full_zones[Small], "SMALL", &i, total_for_user, total_by_fact);
+    print_zone_list_mem(arena->first_empty_zones[Small], "SMALL", &i, total_for_user, total_by_fact);
+#endif
+#ifdef MEDIUM_CLASS
+
+    i = 0;
+    print_zone_list_mem(arena->first_medium_zone, "MEDIUM", &i, total_for_user, total_by_fact);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_mem(arena->first_full_zones[Medium], "MEDIUM", &i, total_for_user, total_by_fact);
+    print_zone_list_mem(arena->first_empty_zones[Medium], "MEDIUM", &i, total_for_user, total_by_fact);
+#endif
+#endif
+}
+
+void __print_alloc_mem() {
+    uint64_t total_for_user = 0;
+    uint64_t total_by_fact = 0;
 
-        total_for_user += large_node.size;
-        total_by_fact += zone->total_size + ZONE_HEADER_SIZE;
+    printf("--------------------------------------------\n");
+    for (uint32_t i = 0; i < ARENAS_COUNT; ++i) {
+        if (ARENAS_COUNT > 1) {
+            printf("ARENA %d\n", i);
+        }
+        print_arena_mem(&gArenas[i], &total_for_user, &total_by_fact);
     }
+    print_large_allocations_mem(&total_for_user, &total_by_fact);
 
     printf("TOTAL FOR USER : %llu\n", total_for_user);
     printf("TOTAL BY FACT  : %llu\n", total_by_fact);
@@ -127,39 +197,94 @@ static inline void print_hex_dump_zone_nodes(t_zone *zone) {
     print_hex_dump(node_representation.raw_node + NODE_HEADER_SIZE, node_representation.size);
 }
 
-void __print_alloc_mem_hex_dump() {
-    uint32_t i;
+static void print_large_allocations_hex_dump() {
+    uint32_t i = 0;
+    for (uint32_t shard = 0; shard < LARGE_ALLOCATIONS_SHARDS_COUNT; ++shard) {
+        for (t_zone *zone = gLargeAllocations[shard].first_large_allocation; zone != NULL; zone = zone->next) {
+            printf("LARGE ALLOCATION %d:\n", i);
+            ++i;
+            t_large_node_representation large_node = get_large_node_representation((BYTE *) zone + ZONE_HEADER_SIZE);
+            print_hex_dump(large_node.raw_node + NODE_HEADER_SIZE, large_node.size);
+            printf("\n");
+        }
+    }
+}
 
-    printf("--------------------------------------------\n");
-    i = 0;
-    for (t_zone *zone = gMemoryZones.first_tiny_zone; zone != NULL; zone = zone->next) {
-        printf("TINY ZONE %d:\n", i);
-        ++i;
-        if (zone->last_allocated_node == NULL) {
+#ifdef TINY_SLABS
+static void print_arena_slab_hex_dump(t_memory_zones *arena) {
+    uint32_t i = 0;
+    for (uint64_t page_index = 0; gSlabRegion != NULL && page_index < slab_pages_used(); ++page_index) {
+        t_slab_page *page = &gSlabPages[page_index];
+        if (page->arena != arena || page->slot_size == 0) {
             continue;
         }
-        print_hex_dump_zone_nodes(zone);
-        printf("\n");
-    }
 
-    i = 0;
-    for (t_zone *zone = gMemoryZones.first_small_zone; zone != NULL; zone = zone->next) {
-        printf("SMALL ZONE %d:\n", i);
+        printf("TINY SLAB PAGE %d:\n", i);
         ++i;
-        if (zone->last_allocated_node == NULL) {
-            continue;
+        uint32_t j = 0;
+        for (uint64_t slot = 0; slot < SLAB_PAGE_SIZE / page->slot_size; ++slot) {
+            if (slab_slot_occupied(page, slot)) {
+                printf("MEM SLOT %d:\n", j);
+                print_hex_dump(get_slab_page_memory(page) + slot * page->slot_size, page->slot_size);
+                ++j;
+            }
         }
-        print_hex_dump_zone_nodes(zone);
         printf("\n");
     }
+}
+#endif
+
+static void print_zone_list_hex_dump(t_zone *zone, const char *name, uint32_t *i) {
+    for (; zone != NULL; zone = zone->next) {
+        printf("%s ZONE %d:\n", name, *i);
+        ++*i;
+        zone_lock_acquire(zone);
+        if (zone->last_allocated_node != NULL) {
+            print_hex_dump_zone_nodes(zone);
+            printf("\n");
+        }
+        zone_lock_release(zone);
+    }
+}
+
+static void print_arena_hex_dump(t_memory_zones *arena) {
+    uint32_t i;
 
+#ifdef TINY_SLABS
+    print_arena_slab_hex_dump(arena);
+#endif
     i = 0;
-    for (t_zone *zone = gMemoryZones.first_large_allocation; zone != NULL; zone = zone->next) {
-        printf("LARGE ALLOCATION %d:\n", i);
-        ++i;
-        t_large_node_representation large_node = get_large_node_representation((BYTE *) zone + ZONE_HEADER_SIZE);
-        print_hex_dump(large_node.raw_node + NODE_HEADER_SIZE, large_node.size);
-        printf("\n");
+    print_zone_list_hex_dump(arena->first_tiny_zone, "TINY", &i);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_hex_dump(arena->first_full_zones[Tiny], "TINY", &i);
+    print_zone_list_hex_dump(arena->first_empty_zones[Tiny], "TINY", &i);
+#endif
+
+    i = 0;
+    print_zone_list_hex_dump(arena->first_small_zone, "SMALL", &i);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_hex_dump(arena->first_full_zones[Small], "SMALL", &i);
+    print_zone_list_hex_dump(arena->first_empty_zones[Small], "SMALL", &i);
+#endif
+#ifdef MEDIUM_CLASS
+
+    i = 0;
+    print_zone_list_hex_dump(arena->first_medium_zone, "MEDIUM", &i);
+#ifdef ZONE_STATE_LISTS
+    print_zone_list_hex_dump(arena->first_full_zones[Medium], "MEDIUM", &i);
+    print_zone_list_hex_dump(arena->first_empty_zones[Medium], "MEDIUM", &i);
+#endif
+#endif
+}
+
+void __print_alloc_mem_hex_dump() {
+    printf("--------------------------------------------\n");
+    for (uint32_t i = 0; i < ARENAS_COUNT; ++i) {
+        if (ARENAS_COUNT > 1) {
+            printf("ARENA %d\n", i);
+        }
+        print_arena_hex_dump(&gArenas[i]);
     }
+    print_large_allocations_hex_dump();
     printf("--------------------------------------------\n");
 }
\ No newline at end of file
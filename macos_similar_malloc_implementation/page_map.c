@@ -0,0 +1,94 @@
+#include "malloc_internal.h"
+#include "utilities.h"
+
+#ifdef SAFE_FREE
+static uint64_t** gPageMapRoot[PAGE_MAP_NODE_SIZE];  /// middle nodes, they point to leaves with entries
+
+static inline uint64_t page_map_index(uint64_t page, uint64_t level) {
+    return (page >> (PAGE_MAP_LEVEL_BITS * (PAGE_MAP_LEVELS - 1 - level))) & (PAGE_MAP_NODE_SIZE - 1);
+}
+
+/// missing node is mapped and published with CAS, thread which lost the race unmaps its node.
+static void* get_or_create_page_map_node(void** slot) {
+    void* node = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (node != NULL) {
+        return node;
+    }
+    void* new_node = mmap(NULL, PAGE_MAP_NODE_SIZE * sizeof(void*), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                          VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+    if (new_node == MAP_FAILED) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(slot, &node, new_node, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(new_node, PAGE_MAP_NODE_SIZE * sizeof(void*));
+        return node;
+    }
+    return new_node;
+}
+
+static BOOL set_pages(t_zone* zone, uint64_t entry) {
+    uint64_t first_page = (uint64_t)zone >> PAGE_MAP_PAGE_SHIFT;
+    uint64_t last_page = ((uint64_t)zone + ZONE_HEADER_SIZE + zone->total_size - 1) >> PAGE_MAP_PAGE_SHIFT;
+    for (uint64_t page = first_page; page <= last_page; ++page) {
+        uint64_t** middle_node = get_or_create_page_map_node((void**)&gPageMapRoot[page_map_index(page, 0)]);
+        if (!middle_node) {
+            return FALSE;
+        }
+        uint64_t* leaf = get_or_create_page_map_node((void**)&middle_node[page_map_index(page, 1)]);
+        if (!leaf) {
+            return FALSE;
+        }
+        __atomic_store_n(&leaf[page_map_index(page, 2)], entry, __ATOMIC_RELEASE);
+    }
+    return TRUE;
+}
+
+/// zone total_size, ZONE_HEADER_SIZE and arena should be set. Returns FALSE if page map node can't be mapped.
+BOOL page_map_set(t_zone* zone, t_allocation_type type) {
+    uint64_t arena_index = (uint64_t)(zone->arena - gArenas);
+    if (!set_pages(zone, (uint64_t)zone | (arena_index << PAGE_MAP_ARENA_SHIFT) | type)) {
+        page_map_clear(zone);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/// should be called before zone is unmapped, so its pages don't point to zone mapped later at the same address.
+void page_map_clear(t_zone* zone) {
+    uint64_t first_page = (uint64_t)zone >> PAGE_MAP_PAGE_SHIFT;
+    uint64_t last_page = ((uint64_t)zone + ZONE_HEADER_SIZE + zone->total_size - 1) >> PAGE_MAP_PAGE_SHIFT;
+    for (uint64_t page = first_page; page <= last_page; ++page) {
+        uint64_t** middle_node = __atomic_load_n(&gPageMapRoot[page_map_index(page, 0)], __ATOMIC_ACQUIRE);
+        if (!middle_node) {
+            continue;
+        }
+        uint64_t* leaf = __atomic_load_n(&middle_node[page_map_index(page, 1)], __ATOMIC_ACQUIRE);
+        if (leaf) {
+            __atomic_store_n(&leaf[page_map_index(page, 2)], 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/// returns zone whose pages contain ptr or NULL, doesn't take any lock and doesn't read zone memory.
+/// arena can be NULL if it isn't needed.
+t_zone* page_map_get(void* ptr, t_allocation_type* type, t_memory_zones** arena) {
+    uint64_t page = (uint64_t)ptr >> PAGE_MAP_PAGE_SHIFT;
+    if (page >> (PAGE_MAP_LEVEL_BITS * PAGE_MAP_LEVELS)) {
+        return NULL;
+    }
+    uint64_t** middle_node = __atomic_load_n(&gPageMapRoot[page_map_index(page, 0)], __ATOMIC_ACQUIRE);
+    if (!middle_node) {
+        return NULL;
+    }
+    uint64_t* leaf = __atomic_load_n(&middle_node[page_map_index(page, 1)], __ATOMIC_ACQUIRE);
+    if (!leaf) {
+        return NULL;
+    }
+    uint64_t entry = __atomic_load_n(&leaf[page_map_index(page, 2)], __ATOMIC_ACQUIRE);
+    *type = (t_allocation_type)(entry & PAGE_MAP_TYPE_MASK);
+    if (arena) {
+        *arena = &gArenas[(entry & PAGE_MAP_ARENA_MASK) >> PAGE_MAP_ARENA_SHIFT];
+    }
+    return (t_zone*)(entry & ~(PAGE_MAP_TYPE_MASK | PAGE_MAP_ARENA_MASK));
+}
+#endif
@@ -5,11 +5,30 @@ void* __realloc(void* ptr, size_t new_size) {
     if (ptr == NULL) {
         return __malloc(new_size);
     }
+    /// new memory is taken from the same arena, it's the only one locked by caller
+    t_memory_zones* arena = get_user_memory_arena(ptr);
     if (new_size == 0) {
-        __free(ptr);
-        return __malloc(MINIMUM_SIZE_TO_ALLOCATE);
+        free_user_memory(ptr);
+        return arena_malloc(arena, MINIMUM_SIZE_TO_ALLOCATE);
     }
 
+#ifdef TINY_SLABS
+    /// slot size is fixed, memory is moved if it doesn't fit
+    if (is_slab_memory(ptr)) {
+        uint64_t slot_size = get_user_memory_size(ptr);
+        if (new_size <= slot_size) {
+            return ptr;
+        }
+        void* mem = arena_malloc(arena, new_size);
+        if (!mem) {
+            return NULL;
+        }
+        memcpy(mem, ptr, slot_size);
+        slab_free(ptr);
+        return mem;
+    }
+#endif
+
     new_size = new_size + 15 & ~15;
     BYTE* node = (BYTE*)ptr - NODE_HEADER_SIZE;
     t_allocation_type allocation_type_from_node = get_node_allocation_type(node);
@@ -20,23 +39,58 @@ void* __realloc(void* ptr, size_t new_size) {
     }
     else if (allocation_type_from_node == Large) {
         t_large_node_representation node_representation = get_large_node_representation(node);
+#ifdef LARGE_REMAP
+        BOOL remappable = node_representation.size >= LARGE_REMAP_MIN_SIZE;
+#ifdef BUDDY_ALLOCATOR
+        remappable = remappable && node_representation.zone->buddy_region == NULL;
+#endif
+        if (remappable && (node_representation.zone->total_size - NODE_HEADER_SIZE < new_size ||
+                           calculate_zone_size(Large, new_size) <= get_zone_mapping_size(node_representation.zone) / 2)) {
+            t_zone* zone = large_remap(node_representation.zone, new_size);
+            if (zone) {
+                node = (BYTE*)zone + ZONE_HEADER_SIZE;
+                set_node_size(node, new_size, Large);
+                return (void*)(node + NODE_HEADER_SIZE);
+            }
+        }
+#endif
         if (node_representation.zone->total_size - NODE_HEADER_SIZE >= new_size) {
             set_node_size(node, new_size, Large);
+#ifdef LARGE_TRIM
+            large_trim(node_representation.zone, new_size);
+#endif
             return ptr;
         }
     }
     else {
         uint64_t separate_size = (allocation_type_from_node == Tiny) ? (TINY_SEPARATE_SIZE) : (SMALL_SEPARATE_SIZE);
-        if (reallocate_memory_in_zone(node, new_size, separate_size)) {
+#ifdef MEDIUM_CLASS
+        if (allocation_type_from_node == Medium) {
+            separate_size = MEDIUM_SEPARATE_SIZE;
+        }
+#endif
+        t_zone* zone = get_node_zone(node);
+        zone_lock_acquire(zone);
+        BOOL reallocated = reallocate_memory_in_zone(node, new_size, separate_size);
+#ifdef ZONE_STATE_LISTS
+        BOOL zone_state_changed = zone_needs_refresh(zone, allocation_type_from_node);
+#endif
+        zone_lock_release(zone);
+#ifdef ZONE_STATE_LISTS
+        if (zone_state_changed) {
+            refresh_zone_state(arena, zone, allocation_type_from_node);
+        }
+#endif
+        if (reallocated) {
             return ptr;
         }
     }
 
-    void* mem = __malloc(new_size);
+    void* mem = arena_malloc(arena, new_size);
     if (!mem) {
         return NULL;
     }
     memcpy(mem, (void*)(node + NODE_HEADER_SIZE), get_node_size(node, allocation_type_from_node));
-    __free((void*)(node + NODE_HEADER_SIZE));
+    free_user_memory((void*)(node + NODE_HEADER_SIZE));
     return mem;
 }
\ No newline at end of file
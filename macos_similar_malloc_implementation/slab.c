@@ -0,0 +1,189 @@
+#include "malloc_internal.h"
+#include "utilities.h"
+
+#ifdef TINY_SLABS
+BYTE* gSlabRegion = NULL;
+t_slab_page* gSlabPages = NULL;
+uint64_t gSlabPagesUsed = 0;  /// pages cut from region, can exceed SLAB_PAGES_COUNT when region is exhausted
+
+#define SLAB_METADATA_SIZE (SLAB_PAGES_COUNT * sizeof(t_slab_page))
+
+/// region is only reserved, pages and their metadata get physical memory on first touch.
+BOOL slab_init() {
+    BYTE* region = (BYTE*)mmap(NULL, SLAB_METADATA_SIZE + SLAB_REGION_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+    if ((void*)region == MAP_FAILED) {
+        return FALSE;
+    }
+    gSlabPages = (t_slab_page*)region;
+    gSlabPagesUsed = 0;
+    __atomic_store_n(&gSlabRegion, region + SLAB_METADATA_SIZE, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+void slab_clear() {
+    if (gSlabRegion == NULL) {
+        return;
+    }
+    munmap(gSlabPages, SLAB_METADATA_SIZE + SLAB_REGION_SIZE);
+    __atomic_store_n(&gSlabRegion, NULL, __ATOMIC_RELEASE);
+    gSlabPages = NULL;
+    gSlabPagesUsed = 0;
+}
+
+static inline uint64_t to_slab_list_index(uint64_t slot_size) {
+    return slot_size / 16 - 1;
+}
+
+static inline void add_page_to_list(t_slab_page** first_page, t_slab_page* page) {
+    page->prev = NULL;
+    page->next = *first_page;
+    if (*first_page) {
+        (*first_page)->prev = page;
+    }
+    *first_page = page;
+}
+
+static inline void delete_page_from_list(t_slab_page** first_page, t_slab_page* page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    }
+    else {
+        *first_page = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+}
+
+/// memory of empty page is given back, page metadata is kept at region start.
+static inline void purge_slab_page(t_slab_page* page) {
+    madvise(get_slab_page_memory(page), SLAB_PAGE_SIZE, PURGE_PAGES_MADVISE);
+#ifdef DECAY
+    page->free_since = DECAY_PURGED;
+#endif
+}
+
+/// empty page of arena is reused first, new page is cut from region otherwise.
+static t_slab_page* take_slab_page(t_memory_zones* arena, uint64_t slot_size) {
+    t_slab_page* page = arena->empty_slab_pages;
+    if (page) {
+        delete_page_from_list(&arena->empty_slab_pages, page);
+    }
+    else {
+        uint64_t index = __atomic_fetch_add(&gSlabPagesUsed, 1, __ATOMIC_RELAXED);
+        if (index >= SLAB_PAGES_COUNT) {
+            return NULL;
+        }
+        page = &gSlabPages[index];
+        __atomic_store_n(&page->arena, arena, __ATOMIC_RELAXED);
+    }
+
+    uint64_t slots_number = SLAB_PAGE_SIZE / slot_size;
+    for (uint64_t i = 0; i < SLAB_BITMAP_WORDS; ++i) {
+        if (slots_number >= (i + 1) * 64) {
+            page->free_slots[i] = UINT64_MAX;
+        }
+        else if (slots_number > i * 64) {
+            page->free_slots[i] = (1ull << (slots_number - i * 64)) - 1;
+        }
+        else {
+            page->free_slots[i] = 0;
+        }
+    }
+    page->slot_size = (uint32_t)slot_size;
+    page->free_slots_number = (uint32_t)slots_number;
+    add_page_to_list(&arena->slab_pages[to_slab_list_index(slot_size)], page);
+    return page;
+}
+
+/// required_size should be 16 byte aligned and fit tiny class, returns NULL if region is exhausted.
+void* slab_malloc(t_memory_zones* arena, uint64_t required_size) {
+    if (gSlabRegion == NULL) {
+        return NULL;
+    }
+    class_lock_acquire(arena, Tiny);
+    t_slab_page** first_page = &arena->slab_pages[to_slab_list_index(required_size)];
+    t_slab_page* page = *first_page;
+    if (page == NULL && (page = take_slab_page(arena, required_size)) == NULL) {
+        class_lock_release(arena, Tiny);
+        return NULL;
+    }
+
+    /// page in list has at least one free slot
+    uint64_t word = 0;
+    while (page->free_slots[word] == 0) {
+        ++word;
+    }
+    uint64_t slot = word * 64 + (uint64_t)__builtin_ctzll(page->free_slots[word]);
+    page->free_slots[word] &= page->free_slots[word] - 1;
+    if (--page->free_slots_number == 0) {
+        delete_page_from_list(first_page, page);
+    }
+    class_lock_release(arena, Tiny);
+    return get_slab_page_memory(page) + slot * required_size;
+}
+
+/// ptr should be occupied slot, its arena lock should be held.
+/// With FINE_GRAINED_LOCKS tiny class lock shouldn't be held, it's taken here.
+void slab_free(void* ptr) {
+    t_slab_page* page = get_slab_page(ptr);
+    t_memory_zones* arena = page->arena;
+    class_lock_acquire(arena, Tiny);
+    uint64_t slot = get_slab_slot_index(page, ptr);
+    page->free_slots[slot / 64] |= 1ull << (slot % 64);
+
+    t_slab_page** first_page = &arena->slab_pages[to_slab_list_index(page->slot_size)];
+    if (page->free_slots_number++ == 0) {
+        add_page_to_list(first_page, page);
+    }
+    if (page->free_slots_number == SLAB_PAGE_SIZE / page->slot_size) {
+        delete_page_from_list(first_page, page);
+        page->slot_size = 0;
+#ifdef DECAY
+        page->free_since = decay_now();
+#else
+        /// the first empty page of arena is kept, like the first empty zone of class
+        if (arena->empty_slab_pages != NULL) {
+            purge_slab_page(page);
+        }
+#endif
+        add_page_to_list(&arena->empty_slab_pages, page);
+    }
+    class_lock_release(arena, Tiny);
+}
+
+#ifdef DECAY
+/// Pages are added to the head of empty list, so list is ordered by free_since
+/// and walk stops at the first purged page. Tiny class lock shouldn't be held.
+void slab_decay(t_memory_zones* arena, uint64_t now) {
+    uint64_t decay_time = __atomic_load_n(&gDecayTimeMs, __ATOMIC_RELAXED);
+    class_lock_acquire(arena, Tiny);
+    t_slab_page* page = arena->empty_slab_pages;
+    while (page != NULL && page->free_since != DECAY_PURGED) {
+        if (now >= page->free_since + decay_time) {
+            purge_slab_page(page);
+        }
+        page = page->next;
+    }
+    class_lock_release(arena, Tiny);
+}
+#endif
+
+/// checks that ptr is start of occupied slot. Caller is responsible for locking.
+BOOL slab_contains_user_memory(void* ptr) {
+    if (!is_slab_memory(ptr)) {
+        return FALSE;
+    }
+    t_slab_page* page = get_slab_page(ptr);
+    if ((uint64_t)(page - gSlabPages) >= __atomic_load_n(&gSlabPagesUsed, __ATOMIC_RELAXED) ||
+        page->slot_size == 0 || ((BYTE*)ptr - get_slab_page_memory(page)) % page->slot_size != 0) {
+        return FALSE;
+    }
+    uint64_t slot = get_slab_slot_index(page, ptr);
+    if (slot >= SLAB_PAGE_SIZE / page->slot_size) {
+        return FALSE;
+    }
+    return (page->free_slots[slot / 64] & (1ull << (slot % 64))) == 0;
+}
+#endif
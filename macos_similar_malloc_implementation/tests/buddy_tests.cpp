@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "malloc_internal.h"
+#include "utilities.h"
+}
+
+#ifdef BUDDY_ALLOCATOR
+
+static t_zone* get_user_memory_zone(void* mem) {
+    return get_node_zone((BYTE*)mem - NODE_HEADER_SIZE);
+}
+
+TEST(Buddy, Malloc_Free) {
+    __free_all();
+    t_buddy_allocator* allocator = &gBuddyAllocators[0];
+
+    /// 64 kb with headers takes 32 pages block, 64 kb itself is medium with MEDIUM_CLASS
+    const uint64_t size = BUDDY_MIN_ALLOCATION_SIZE + 16;
+    const uint64_t block_size = BUDDY_PAGE_SIZE * 32;
+    void* mem1 = __malloc(size);
+    t_zone* zone1 = get_user_memory_zone(mem1);
+    ASSERT_EQ(get_user_memory_allocation_type(mem1), Large);
+    ASSERT_NE(zone1->buddy_region, nullptr);
+    ASSERT_EQ((uint64_t)zone1 % BUDDY_PAGE_SIZE, 0);
+    ASSERT_EQ(zone1->total_size, block_size - ZONE_HEADER_SIZE);
+    ASSERT_EQ(zone1->arena, &gMemoryZones);
+
+    /// bigger block is split, its upper half stays free
+    void* mem2 = __malloc(size);
+    t_zone* zone2 = get_user_memory_zone(mem2);
+    ASSERT_EQ((BYTE*)zone2, (BYTE*)zone1 + block_size);
+    ASSERT_EQ((BYTE*)allocator->free_blocks[5], (BYTE*)zone2 + block_size);
+
+    /// freed block is merged with its free buddy
+    __free(mem2);
+    ASSERT_EQ(allocator->free_blocks[5], nullptr);
+    ASSERT_EQ(allocator->free_blocks_bitmap & (1u << 5), 0);
+    ASSERT_EQ((BYTE*)allocator->free_blocks[6], (BYTE*)zone2);
+    ASSERT_EQ(__malloc(size), mem2);
+
+    ASSERT_TRUE(zones_contains_user_memory(mem1));
+    ASSERT_EQ(large_allocations_number(), 2);
+    __free(mem1);
+    __free(mem2);
+    ASSERT_FALSE(zones_contains_user_memory(mem1));
+    ASSERT_EQ(large_allocations_number(), 0);
+
+    /// smaller large sizes keep own mappings
+    void* own_mapping_mem = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+    if (LARGE_ALLOCATION_MIN_SIZE < BUDDY_MIN_ALLOCATION_SIZE) {
+        ASSERT_EQ(get_user_memory_zone(own_mapping_mem)->buddy_region, nullptr);
+    }
+    __free(own_mapping_mem);
+}
+
+TEST(Buddy, Regions) {
+    __free_all();
+    t_buddy_allocator* allocator = &gBuddyAllocators[0];
+
+    /// the biggest allocation takes half of region, the other half holds metadata
+    void* mem1 = __malloc(BUDDY_MAX_ALLOCATION_SIZE);
+    void* mem2 = __malloc(BUDDY_MAX_ALLOCATION_SIZE);
+    t_buddy_region* region1 = get_user_memory_zone(mem1)->buddy_region;
+    t_buddy_region* region2 = get_user_memory_zone(mem2)->buddy_region;
+    ASSERT_NE(region1, region2);
+    ASSERT_EQ((uint64_t)region1 % BUDDY_REGION_SIZE, 0);
+    ASSERT_EQ(allocator->empty_regions_number, 0);
+
+    /// one totally free region is kept, the next one is unmapped
+    __free(mem1);
+    ASSERT_EQ(allocator->empty_regions_number, 1);
+    __free(mem2);
+    ASSERT_EQ(allocator->empty_regions_number, 1);
+    ASSERT_EQ(allocator->first_region, region1);
+    ASSERT_EQ(region1->next, nullptr);
+
+    /// kept region serves next allocation without mapping
+    ASSERT_EQ(__malloc(BUDDY_MAX_ALLOCATION_SIZE), mem1);
+    ASSERT_EQ(allocator->empty_regions_number, 0);
+    __free(mem1);
+}
+
+TEST(Buddy, Realloc) {
+    __free_all();
+
+    BYTE* mem = (BYTE*)__malloc(100000);
+    memset(mem, 'a', 100000);
+    ASSERT_EQ(__realloc(mem, 120000), mem);
+
+    BYTE* new_mem = (BYTE*)__realloc(mem, 200000);
+    ASSERT_NE(new_mem, mem);
+    ASSERT_NE(get_user_memory_zone(new_mem)->buddy_region, nullptr);
+    for (uint64_t i = 0; i < 100000; ++i) {
+        ASSERT_EQ(new_mem[i], 'a');
+    }
+    ASSERT_EQ(large_allocations_number(), 1);
+    __free(new_mem);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "malloc_internal.h"
+#include "utilities.h"
+}
+
+TEST(Deferred_Free, Push_Pop) {
+    __free_all();
+    t_deferred_free_ring* ring = deferred_free_ring_acquire();
+    ASSERT_NE(ring, nullptr);
+    ASSERT_EQ(deferred_free_pop(ring), nullptr);
+
+    void* mem1 = __malloc(16);
+    void* mem2 = __malloc(SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_TRUE(deferred_free_push(ring, mem1));
+    ASSERT_TRUE(deferred_free_push(ring, mem2));
+    ASSERT_EQ(deferred_free_ring_size(ring), 2);
+    ASSERT_EQ(ring->bytes, get_user_memory_size(mem1) + get_user_memory_size(mem2));
+
+    /// pushed memory isn't freed
+    ASSERT_EQ(get_node_available((BYTE*)mem1 - NODE_HEADER_SIZE), FALSE);
+
+    ASSERT_EQ(deferred_free_pop(ring), mem1);
+    ASSERT_EQ(deferred_free_pop(ring), mem2);
+    ASSERT_EQ(deferred_free_pop(ring), nullptr);
+    ASSERT_EQ(ring->bytes, 0);
+
+    __free(mem1);
+    __free(mem2);
+    deferred_free_ring_release(ring);
+}
+
+TEST(Deferred_Free, Bounds) {
+    __free_all();
+    t_deferred_free_ring* ring = deferred_free_ring_acquire();
+
+    /// memory bound
+    void* large_mem = __malloc(DEFERRED_FREE_RING_MAX_BYTES);
+    void* small_mem = __malloc(16);
+    ASSERT_TRUE(deferred_free_push(ring, large_mem));
+    ASSERT_FALSE(deferred_free_push(ring, small_mem));
+    ASSERT_EQ(deferred_free_pop(ring), large_mem);
+    __free(large_mem);
+
+    /// pointers number bound
+    for (uint64_t i = 0; i < DEFERRED_FREE_RING_CAPACITY; ++i) {
+        ASSERT_TRUE(deferred_free_push(ring, small_mem));
+    }
+    ASSERT_FALSE(deferred_free_push(ring, small_mem));
+    while (deferred_free_pop(ring) != nullptr) {
+    }
+    ASSERT_TRUE(deferred_free_push(ring, small_mem));
+    ASSERT_EQ(deferred_free_pop(ring), small_mem);
+    __free(small_mem);
+
+    /// released ring is reused
+    deferred_free_ring_release(ring);
+    ASSERT_EQ(deferred_free_ring_acquire(), ring);
+    deferred_free_ring_release(ring);
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <array>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include "malloc_internal.h"
@@ -15,56 +17,119 @@ TEST(Free_All, Check_Correct) {
     ASSERT_EQ(gInit, false);
     ASSERT_EQ(gMemoryZones.first_tiny_zone, nullptr);
     ASSERT_EQ(gMemoryZones.first_small_zone, nullptr);
-    ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
 }
 
 TEST(Free, Large) {
     __free_all();
 
-    void* mem1 = __malloc(SMALL_ALLOCATION_MAX_SIZE + 1);
-    ASSERT_EQ((BYTE*)gMemoryZones.first_large_allocation, (BYTE*)mem1 - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    void* mem1 = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+    ASSERT_TRUE(large_allocations_contains_user_memory(mem1));
+    ASSERT_EQ(large_allocations_number(), 1);
 
-    void* mem2 = __malloc(SMALL_ALLOCATION_MAX_SIZE + 1);
-    ASSERT_FALSE(gMemoryZones.first_large_allocation == gMemoryZones.last_large_allocation);
-    ASSERT_EQ((BYTE*)gMemoryZones.last_large_allocation, (BYTE*)mem2 - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    void* mem2 = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+    ASSERT_TRUE(large_allocations_contains_user_memory(mem2));
+    ASSERT_EQ(large_allocations_number(), 2);
 
     __free(mem1);
-    ASSERT_TRUE(gMemoryZones.first_large_allocation == gMemoryZones.last_large_allocation);
-    ASSERT_EQ((BYTE*)gMemoryZones.first_large_allocation, (BYTE*)mem2 - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    ASSERT_FALSE(large_allocations_contains_user_memory(mem1));
+    ASSERT_TRUE(large_allocations_contains_user_memory(mem2));
+    ASSERT_EQ(large_allocations_number(), 1);
 
     __free(mem2);
-    ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
-    ASSERT_EQ(gMemoryZones.last_large_allocation, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
+    for (auto& shard : gLargeAllocations) {
+        ASSERT_EQ(shard.first_large_allocation, nullptr);
+        ASSERT_EQ(shard.last_large_allocation, nullptr);
+    }
 }
 
+#ifdef LARGE_CACHE
+TEST(Free, Large_Cache) {
+    __free_all();
+    uint64_t max_bytes = gLargeCacheMaxBytes;
+    uint64_t decay_time = gLargeCacheDecayTimeMs;
+    gLargeCacheDecayTimeMs = 1000000;
+
+    /// size and its third are bigger than medium and buddy allocations, so they always have own mappings
+    const uint64_t size = 0x1000000;
+    const uint64_t third_size = size / 3 & ~15ull;
+    void* mem = __malloc(size);
+    uint64_t mapping_size = get_zone_mapping_size(get_node_zone((BYTE*)mem - NODE_HEADER_SIZE));
+    __free(mem);
+    ASSERT_EQ(gLargeCache.bytes, mapping_size);
+    ASSERT_FALSE(zones_contains_user_memory(mem));
+
+    /// cached mapping serves requests from half of its size to its size, mapping_size user memory needs bigger one
+    void* bigger_mem = __malloc(mapping_size);
+    ASSERT_NE(bigger_mem, mem);
+    void* third_mem = __malloc(third_size);
+    ASSERT_NE(third_mem, mem);
+    ASSERT_EQ(__malloc(size - 4096), mem);
+    ASSERT_EQ(gLargeCache.bytes, 0);
+    ASSERT_TRUE(zones_contains_user_memory(mem));
+    ASSERT_EQ(get_user_memory_size(mem), size - 4096);
+
+    /// the oldest mapping is unmapped to fit cache limit
+    gLargeCacheMaxBytes = mapping_size + mapping_size / 2;
+    __free(mem);
+    __free(bigger_mem);
+    ASSERT_TRUE(gLargeCache.bytes <= gLargeCacheMaxBytes);
+    ASSERT_EQ(__malloc(size), bigger_mem);
+
+    /// expired mappings are unmapped on next large malloc or free
+    __free(third_mem);
+    __free(bigger_mem);
+    ASSERT_TRUE(gLargeCache.bytes > 0);
+    gLargeCacheDecayTimeMs = 0;
+    third_mem = __malloc(third_size);
+    ASSERT_EQ(gLargeCache.bytes, 0);
+    __free(third_mem);
+
+    gLargeCacheMaxBytes = max_bytes;
+    gLargeCacheDecayTimeMs = decay_time;
+}
+#endif
+
+/// tiny allocations don't go to zones with TINY_SLABS, slabs are checked in slab tests.
+/// With ZONE_STATE_LISTS free zones leave zone list, state lists are checked in their own test.
+#if !defined(TINY_SLABS) && !defined(ZONE_STATE_LISTS)
 TEST(Free, Tiny_Small_Basic) {
     __free_all();
-    std::array<void*, 60000> ptr_arr{};
+    /// enough for two zones
+    const uint64_t nodes_number = (TINY_ZONE_SIZE - ZONE_HEADER_SIZE) / (16 + NODE_HEADER_SIZE) * 3 / 2;
+    std::vector<void*> ptr_arr(nodes_number);
 
     {
         /// free both zones from the end
-        for (uint64_t i = 0; i < 60000; ++i) {
+        for (uint64_t i = 0; i < nodes_number; ++i) {
             ptr_arr[i] = __malloc(16);
         }
         ASSERT_FALSE(gMemoryZones.first_tiny_zone == gMemoryZones.last_tiny_zone);
         ASSERT_EQ(gMemoryZones.first_tiny_zone->next, gMemoryZones.last_tiny_zone);
-        for (uint64_t i = 60000; i > 0; --i) {
+        for (uint64_t i = nodes_number; i > 0; --i) {
             __free(ptr_arr[i - 1]);
         }
+#ifdef DECAY
+        arena_decay(&gMemoryZones, decay_now() + gDecayTimeMs);
+#endif
         ASSERT_EQ(gMemoryZones.first_tiny_zone, gMemoryZones.last_tiny_zone);
         ASSERT_EQ((BYTE*)gMemoryZones.first_tiny_zone->last_allocated_node, nullptr);
     }
 
     {
         /// free both zones from the begin
-        for (uint64_t i = 0; i < 60000; ++i) {
+        for (uint64_t i = 0; i < nodes_number; ++i) {
             ptr_arr[i] = __malloc(16);
         }
         ASSERT_FALSE(gMemoryZones.first_tiny_zone == gMemoryZones.last_tiny_zone);
         ASSERT_EQ(gMemoryZones.first_tiny_zone->next, gMemoryZones.last_tiny_zone);
-        for (uint64_t i = 0; i < 60000; ++i) {
+        for (uint64_t i = 0; i < nodes_number; ++i) {
             __free(ptr_arr[i]);
         }
+#ifdef DECAY
+        arena_decay(&gMemoryZones, decay_now() + gDecayTimeMs);
+#endif
         ASSERT_EQ(gMemoryZones.first_tiny_zone, gMemoryZones.last_tiny_zone);
         ASSERT_EQ((BYTE*)gMemoryZones.first_tiny_zone->last_allocated_node, nullptr);
     }
@@ -96,3 +161,426 @@ TEST(Free, Tiny_Small_Basic) {
         ASSERT_EQ((BYTE*)gMemoryZones.first_tiny_zone->last_allocated_node, nullptr);
     }
 }
+#endif
+
+#if defined(DECAY) && !defined(TINY_SLABS)
+TEST(Free, Decay) {
+    __free_all();
+    uint64_t decay_time = gDecayTimeMs;
+    gDecayTimeMs = 1000;
+    /// enough for two zones
+    std::vector<void*> ptr_arr((TINY_ZONE_SIZE - ZONE_HEADER_SIZE) / (16 + NODE_HEADER_SIZE) * 3 / 2);
+
+    for (auto& ptr : ptr_arr) {
+        ptr = __malloc(16);
+    }
+    t_zone* first_zone = get_node_zone((BYTE*)ptr_arr.front() - NODE_HEADER_SIZE);
+    t_zone* last_zone = get_node_zone((BYTE*)ptr_arr.back() - NODE_HEADER_SIZE);
+    ASSERT_NE(first_zone, last_zone);
+    for (auto ptr : ptr_arr) {
+        __free(ptr);
+    }
+#ifdef ZONE_STATE_LISTS
+    /// free zones are kept in empty list, reused zone goes to its end, so it's the one which is kept
+    t_zone** first_free_zone = &gMemoryZones.first_empty_zones[Tiny];
+    t_zone** last_free_zone = &gMemoryZones.last_empty_zones[Tiny];
+    t_zone* kept_zone = first_zone;
+#else
+    t_zone** first_free_zone = &gMemoryZones.first_tiny_zone;
+    t_zone** last_free_zone = &gMemoryZones.last_tiny_zone;
+    t_zone* kept_zone = last_zone;
+#endif
+
+    /// free zones are kept until decay time passes
+    ASSERT_NE(first_zone->free_since, 0);
+    ASSERT_NE(last_zone->free_since, 0);
+    arena_decay(&gMemoryZones, decay_now());
+    ASSERT_EQ(*first_free_zone, first_zone);
+    ASSERT_EQ(*last_free_zone, last_zone);
+
+    /// kept zone is reused
+    void* mem = __malloc(16);
+    ASSERT_EQ(first_zone->free_since, 0);
+    __free(mem);
+
+    /// one zone is unmapped, the other can't be, its pages are purged
+    arena_decay(&gMemoryZones, decay_now() + gDecayTimeMs);
+    ASSERT_EQ(*first_free_zone, kept_zone);
+    ASSERT_EQ(*last_free_zone, kept_zone);
+    ASSERT_EQ(kept_zone->free_since, DECAY_PURGED);
+
+    /// purged zone works as usual
+    mem = __malloc(16);
+    ASSERT_EQ((BYTE*)mem, (BYTE*)kept_zone + ZONE_HEADER_SIZE + NODE_HEADER_SIZE);
+    ASSERT_EQ(kept_zone->free_since, 0);
+    __free(mem);
+    gDecayTimeMs = decay_time;
+}
+#endif
+
+TEST(Free, Remote_Free) {
+    __free_all();
+    ASSERT_TRUE(init());
+    t_zone* tiny_zone = gMemoryZones.first_tiny_zone;
+    t_zone* small_zone = gMemoryZones.first_small_zone;
+
+    void* tiny_mem = __malloc(16);
+    void* small_mem = __malloc(SMALL_ALLOCATION_MAX_SIZE);
+    void* large_mem = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+
+    arena_push_remote_free(&gMemoryZones, tiny_mem);
+    arena_push_remote_free(&gMemoryZones, small_mem);
+    arena_push_remote_free(&gMemoryZones, large_mem);
+
+    /// pushed nodes stay occupied until drain
+    ASSERT_EQ(gMemoryZones.remote_free_nodes, (BYTE*)large_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(*(BYTE**)large_mem, (BYTE*)small_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(*(BYTE**)small_mem, (BYTE*)tiny_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(get_node_available((BYTE*)tiny_mem - NODE_HEADER_SIZE), FALSE);
+    ASSERT_EQ(large_allocations_number(), 1);
+
+    arena_drain_remote_frees(&gMemoryZones);
+    ASSERT_EQ(gMemoryZones.remote_free_nodes, nullptr);
+    ASSERT_EQ(tiny_zone->last_allocated_node, nullptr);
+    ASSERT_EQ(small_zone->last_allocated_node, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
+}
+
+#if ARENAS_COUNT > 1
+TEST(Free, Remote_Free_Other_Arenas) {
+    __free_all();
+    ASSERT_TRUE(init());
+    t_memory_zones* idle_arena = &gArenas[1];
+
+    /// small memory always has node header, tiny one could be taken from slab
+    void* small_mem = arena_malloc(idle_arena, TINE_ALLOCATION_MAX_SIZE + 1);
+    void* large_mem = arena_malloc(idle_arena, LARGE_ALLOCATION_MIN_SIZE);
+    t_zone* small_zone = get_node_zone((BYTE*)small_mem - NODE_HEADER_SIZE);
+    arena_push_remote_free(idle_arena, small_mem);
+    arena_push_remote_free(idle_arena, large_mem);
+
+    /// nothing to drain in current arena, idle arena is drained without its owner
+    drain_other_arenas_remote_frees(&gMemoryZones);
+    ASSERT_EQ(idle_arena->remote_free_nodes, nullptr);
+    ASSERT_EQ(small_zone->last_allocated_node, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
+
+    /// busy arena is skipped, its owner drains it
+    small_mem = arena_malloc(idle_arena, TINE_ALLOCATION_MAX_SIZE + 1);
+    arena_push_remote_free(idle_arena, small_mem);
+    arena_lock_acquire(idle_arena);
+    drain_other_arenas_remote_frees(&gMemoryZones);
+#if defined(THREAD_SAFE) && !defined(FINE_GRAINED_LOCKS) && !defined(RUNTIME_LOCK_ELISION)
+    ASSERT_EQ(idle_arena->remote_free_nodes, (BYTE*)small_mem - NODE_HEADER_SIZE);
+    arena_drain_remote_frees(idle_arena);
+#endif
+    arena_lock_release(idle_arena);
+    ASSERT_EQ(idle_arena->remote_free_nodes, nullptr);
+}
+#endif
+
+#ifdef SAFE_FREE
+TEST(Free, Page_Map) {
+    __free_all();
+    ASSERT_TRUE(init());
+    t_allocation_type type;
+
+    BYTE* small_mem = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_EQ(page_map_get(small_mem, &type, nullptr), gMemoryZones.first_small_zone);
+    ASSERT_EQ(type, Small);
+    ASSERT_EQ(find_user_memory_arena(small_mem, &type), &gMemoryZones);
+
+    /// every page of large allocation is mapped, but only its user memory start is valid
+    BYTE* large_mem = (BYTE*)__malloc(LARGE_ALLOCATION_MIN_SIZE * 64);
+    t_zone* large_allocation = (t_zone*)(large_mem - NODE_HEADER_SIZE - ZONE_HEADER_SIZE);
+    ASSERT_EQ(page_map_get(large_mem + LARGE_ALLOCATION_MIN_SIZE * 63, &type, nullptr), large_allocation);
+    ASSERT_EQ(type, Large);
+    ASSERT_TRUE(zones_contains_user_memory(large_mem));
+    ASSERT_FALSE(zones_contains_user_memory(large_mem + 16));
+
+    /// unmapped zone pages are cleared
+    __free(large_mem);
+    ASSERT_EQ(page_map_get(large_mem, &type, nullptr), nullptr);
+    ASSERT_FALSE(zones_contains_user_memory(large_mem));
+    ASSERT_EQ(find_user_memory_arena(large_mem, &type), nullptr);
+
+    int stack_variable;
+    ASSERT_FALSE(zones_contains_user_memory(&stack_variable));
+    __free(small_mem);
+
+    __free_all();
+    ASSERT_EQ(page_map_get(small_mem, &type, nullptr), nullptr);
+    ASSERT_TRUE(init());
+}
+
+/// lookup reads only page map, zone can be made inaccessible (unmapped by racing free of the same pointer)
+TEST(Free, Page_Map_Inaccessible_Zone) {
+    t_memory_zones* arena = &gArenas[ARENAS_COUNT - 1];
+    uint64_t size = gPageSize * 4;
+    t_zone* zone = (t_zone*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    ASSERT_NE(zone, MAP_FAILED);
+    ASSERT_TRUE(construct_zone_header(zone, size, Small, arena));
+    BYTE* mem = (BYTE*)zone + ZONE_HEADER_SIZE + NODE_HEADER_SIZE;
+    ASSERT_EQ(mprotect(zone, size, PROT_NONE), 0);
+
+    t_allocation_type type;
+    ASSERT_EQ(find_user_memory_arena(mem, &type), arena);
+    ASSERT_EQ(type, Small);
+    ASSERT_TRUE(zones_contains_user_memory(mem));
+
+    ASSERT_EQ(mprotect(zone, size, PROT_READ | PROT_WRITE), 0);
+    page_map_clear(zone);
+    munmap(zone, size);
+    ASSERT_EQ(find_user_memory_arena(mem, &type), nullptr);
+}
+
+/// large allocation is checked under its shard lock, second free doesn't read unmapped zone
+TEST(Free, Large_Double_Free) {
+    BYTE* mem = (BYTE*)__malloc(LARGE_ALLOCATION_MIN_SIZE * 64);
+    ASSERT_TRUE(large_free_user_memory(mem));
+    ASSERT_FALSE(large_free_user_memory(mem));
+    __free(mem);
+}
+#endif
+
+#ifdef DEFERRED_COALESCING
+TEST(Free, Deferred_Coalescing) {
+    __free_all();
+
+    BYTE* mem1 = (BYTE*)__malloc(256);
+    BYTE* mem2 = (BYTE*)__malloc(256);
+    BYTE* mem3 = (BYTE*)__malloc(256);
+    t_zone* zone = gMemoryZones.first_small_zone;
+
+    /// freed nodes are kept as they are, the last deferred node is taken back first
+    __free(mem1);
+    __free(mem2);
+    ASSERT_EQ(zone->deferred_nodes_number, 2);
+    ASSERT_EQ(zone->first_deferred_node, mem2 - NODE_HEADER_SIZE);
+    ASSERT_TRUE(get_node_available(mem1 - NODE_HEADER_SIZE));
+    ASSERT_EQ(__malloc(256), mem2);
+    ASSERT_EQ(zone->deferred_nodes_number, 1);
+
+    /// deferred nodes are merged when nothing else fits
+    __free(mem2);
+    BYTE* mem4 = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_EQ(mem4, mem1);
+    ASSERT_EQ(zone->deferred_nodes_number, 0);
+    ASSERT_EQ(zone->first_deferred_node, nullptr);
+
+    /// the last node is released at once with available nodes before it
+    __free(mem4);
+    ASSERT_EQ(zone->deferred_nodes_number, 1);
+    __free(mem3);
+    ASSERT_EQ(zone->last_allocated_node, nullptr);
+    ASSERT_EQ(zone->deferred_nodes_number, 0);
+
+    /// too many deferred nodes are merged
+    BYTE* ptr_arr[DEFERRED_COALESCING_MAX_NODES + 2];
+    for (auto& ptr : ptr_arr) {
+        ptr = (BYTE*)__malloc(256);
+    }
+    for (uint64_t i = 0; i < DEFERRED_COALESCING_MAX_NODES; ++i) {
+        __free(ptr_arr[i]);
+    }
+    ASSERT_EQ(zone->deferred_nodes_number, DEFERRED_COALESCING_MAX_NODES);
+    __free(ptr_arr[DEFERRED_COALESCING_MAX_NODES]);
+    ASSERT_EQ(zone->deferred_nodes_number, 0);
+    ASSERT_EQ(get_node_size(ptr_arr[0] - NODE_HEADER_SIZE, Small),
+              (DEFERRED_COALESCING_MAX_NODES + 1) * (256 + NODE_HEADER_SIZE) - NODE_HEADER_SIZE);
+    __free(ptr_arr[DEFERRED_COALESCING_MAX_NODES + 1]);
+    ASSERT_EQ(zone->last_allocated_node, nullptr);
+}
+#endif
+
+#ifdef ZONE_STATE_LISTS
+TEST(Free, Zone_State_Lists) {
+    __free_all();
+    ASSERT_TRUE(init());
+    t_zone* zone = gMemoryZones.first_small_zone;
+    std::vector<void*> ptr_arr;
+
+    /// zone without tail and free nodes goes to full list
+    while (zone->tail_size >= NODE_HEADER_SIZE + SMALL_ALLOCATION_MAX_SIZE) {
+        ptr_arr.push_back(__malloc(SMALL_ALLOCATION_MAX_SIZE));
+    }
+    if (zone->tail_size >= NODE_HEADER_SIZE + TINE_ALLOCATION_MAX_SIZE + 16) {
+        ptr_arr.push_back(__malloc(zone->tail_size - NODE_HEADER_SIZE));
+    }
+    ASSERT_EQ(zone->state, ZoneFull);
+    ASSERT_EQ(gMemoryZones.first_full_zones[Small], zone);
+    ASSERT_EQ(gMemoryZones.first_small_zone, nullptr);
+
+    /// full zone isn't looked at, new zone is created
+    void* mem = __malloc(SMALL_ALLOCATION_MAX_SIZE);
+    t_zone* second_zone = gMemoryZones.first_small_zone;
+    ASSERT_NE(second_zone, zone);
+    ASSERT_EQ(get_node_zone((BYTE*)mem - NODE_HEADER_SIZE), second_zone);
+
+    /// free moves zone back to partial list
+    __free(ptr_arr[0]);
+    ASSERT_EQ(zone->state, ZonePartial);
+    ASSERT_EQ(gMemoryZones.first_full_zones[Small], nullptr);
+    ASSERT_EQ(gMemoryZones.last_small_zone, zone);
+
+    /// totally free zone goes to empty list, the first empty zone is kept
+    __free(mem);
+    ASSERT_EQ(second_zone->state, ZoneEmpty);
+    ASSERT_EQ(gMemoryZones.first_small_zone, zone);
+    ASSERT_EQ(gMemoryZones.first_empty_zones[Small], second_zone);
+    for (size_t i = 1; i < ptr_arr.size(); ++i) {
+        __free(ptr_arr[i]);
+    }
+    ASSERT_EQ(gMemoryZones.first_small_zone, nullptr);
+    ASSERT_EQ(gMemoryZones.first_empty_zones[Small], second_zone);
+#ifndef DECAY
+    ASSERT_EQ(gMemoryZones.last_empty_zones[Small], second_zone);
+#endif
+
+    /// empty zone is taken when partial zones can't serve malloc
+    mem = __malloc(SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_EQ(get_node_zone((BYTE*)mem - NODE_HEADER_SIZE), second_zone);
+    ASSERT_EQ(second_zone->state, ZonePartial);
+    ASSERT_EQ(gMemoryZones.first_small_zone, second_zone);
+    __free(mem);
+}
+#endif
+
+#if defined(FINE_GRAINED_LOCKS) && defined(THREAD_SAFE)
+/// internals lock by themselves, arena lock isn't taken here.
+TEST(Free, Fine_Grained_Locks_Concurrent) {
+    __free_all();
+    ASSERT_TRUE(init());
+
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([t]() {
+            std::array<void*, 20000> ptr_arr{};
+            for (uint64_t round = 0; round < 5; ++round) {
+                for (uint64_t i = 0; i < ptr_arr.size(); ++i) {
+                    /// tiny, small and rarely large
+                    size_t size = (i % 97 == 0) ? LARGE_ALLOCATION_MIN_SIZE : (i * (t + 1)) % SMALL_ALLOCATION_MAX_SIZE + 1;
+                    ptr_arr[i] = arena_malloc(&gMemoryZones, size);
+                    ASSERT_NE(ptr_arr[i], nullptr);
+                    memset(ptr_arr[i], (int)t, size);
+                }
+                for (uint64_t i = 0; i < ptr_arr.size(); ++i) {
+                    ASSERT_EQ(*(BYTE*)ptr_arr[i], (BYTE)t);
+                    free_user_memory(ptr_arr[i]);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+#ifdef ZONE_STATE_LISTS
+    /// totally free zones are only in empty lists
+#ifndef TINY_SLABS
+    ASSERT_EQ(gMemoryZones.first_tiny_zone, nullptr);
+#endif
+    ASSERT_EQ(gMemoryZones.first_small_zone, nullptr);
+    ASSERT_EQ(gMemoryZones.first_full_zones[Tiny], nullptr);
+    ASSERT_EQ(gMemoryZones.first_full_zones[Small], nullptr);
+    t_zone** first_tiny_zone = &gMemoryZones.first_empty_zones[Tiny];
+    t_zone** last_tiny_zone = &gMemoryZones.last_empty_zones[Tiny];
+    t_zone** first_small_zone = &gMemoryZones.first_empty_zones[Small];
+    t_zone** last_small_zone = &gMemoryZones.last_empty_zones[Small];
+#ifdef TINY_SLABS
+    if (gMemoryZones.first_tiny_zone != nullptr) {
+        /// tiny memory came from slabs, untouched default tiny zone stays in partial list
+        ASSERT_EQ(gMemoryZones.first_empty_zones[Tiny], nullptr);
+        first_tiny_zone = &gMemoryZones.first_tiny_zone;
+        last_tiny_zone = &gMemoryZones.last_tiny_zone;
+    }
+#endif
+#else
+    t_zone** first_tiny_zone = &gMemoryZones.first_tiny_zone;
+    t_zone** last_tiny_zone = &gMemoryZones.last_tiny_zone;
+    t_zone** first_small_zone = &gMemoryZones.first_small_zone;
+    t_zone** last_small_zone = &gMemoryZones.last_small_zone;
+#endif
+#ifdef DECAY
+    /// decay pass unmaps a few zones at once
+    while (*first_tiny_zone != *last_tiny_zone || *first_small_zone != *last_small_zone) {
+        arena_decay(&gMemoryZones, decay_now() + gDecayTimeMs);
+    }
+#endif
+
+    /// every class keeps only one totally free zone
+    ASSERT_EQ(*first_tiny_zone, *last_tiny_zone);
+    ASSERT_EQ((*first_tiny_zone)->last_allocated_node, nullptr);
+    ASSERT_EQ(*first_small_zone, *last_small_zone);
+    ASSERT_EQ((*first_small_zone)->last_allocated_node, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
+}
+#endif
+
+/// deferred nodes aren't merged on free, so free span layout isn't known there.
+#if defined(PURGE_FREE_SPANS) && !defined(DEFERRED_COALESCING)
+TEST(Free, Purge_Free_Spans) {
+    __free_all();
+
+    /// the first and the last nodes stay live, nodes between them are merged into one free span
+    const uint64_t nodes_number = 4096;
+    std::vector<BYTE*> ptr_arr(nodes_number);
+    for (uint64_t i = 0; i < nodes_number; ++i) {
+        ptr_arr[i] = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE);
+        memset(ptr_arr[i], 'a', SMALL_ALLOCATION_MAX_SIZE);
+    }
+    BYTE* first_node = ptr_arr[0] - NODE_HEADER_SIZE;
+    BYTE* last_node = ptr_arr[nodes_number - 1] - NODE_HEADER_SIZE;
+    t_zone* zone = get_node_zone(first_node);
+    ASSERT_EQ(zone, get_node_zone(last_node));
+    ASSERT_EQ(zone->purged_tail, page_ceil(last_node + NODE_HEADER_SIZE + get_node_size(last_node, Small)));
+    for (uint64_t i = 1; i < nodes_number - 1; ++i) {
+        __free(ptr_arr[i]);
+    }
+
+    /// pass was run on the way, the last frees make span dirty again
+    ASSERT_TRUE(zone->dirty_size < zone->total_size / PURGE_DIRTY_RATIO);
+    BYTE* span = get_next_node(zone, first_node);
+    ASSERT_EQ(get_next_node(zone, span), last_node);
+    ASSERT_TRUE(get_node_available(span));
+    purge_free_spans(zone);
+    ASSERT_TRUE(get_node_purged(span));
+    ASSERT_EQ(zone->dirty_size, 0);
+
+    BYTE* pages_start = page_ceil(span + NODE_HEADER_SIZE);
+    uint64_t pages_number = (page_floor(last_node) - pages_start) / gPageSize;
+#ifdef PURGED_MEMORY_IS_ZEROED
+    std::vector<unsigned char> residency(pages_number);
+    ASSERT_EQ(mincore(pages_start, pages_number * gPageSize, residency.data()), 0);
+    for (auto page : residency) {
+        ASSERT_EQ(page & 1, 0);
+    }
+#endif
+
+    /// rest of split purged node stays purged
+    BYTE* mem = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_EQ(mem, span + NODE_HEADER_SIZE);
+    ASSERT_FALSE(get_node_purged(span));
+    ASSERT_TRUE(get_node_purged(get_next_node(zone, span)));
+
+    /// live nodes keep their content
+    ASSERT_EQ(ptr_arr[0][SMALL_ALLOCATION_MAX_SIZE - 1], 'a');
+    ASSERT_EQ(ptr_arr[nodes_number - 1][0], 'a');
+    __free(mem);
+    __free(ptr_arr[0]);
+    __free(ptr_arr[nodes_number - 1]);
+}
+#endif
+
+#if defined(PURGE_FREE_SPANS) && defined(PURGED_MEMORY_IS_ZEROED)
+TEST(Free, Purged_Memory_Report) {
+    __free_all();
+
+    /// pages of new large mapping are reported as zero
+    const uint64_t size = 0x800000;
+    tPurgedMemory.start = nullptr;
+    BYTE* mem = (BYTE*)__malloc(size);
+    ASSERT_EQ(tPurgedMemory.start, page_ceil(mem));
+    ASSERT_EQ(tPurgedMemory.end, page_floor(mem + size));
+    __free(mem);
+}
+#endif
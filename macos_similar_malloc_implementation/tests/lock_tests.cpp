@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <threads.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "malloc_internal.h"
+}
+
+#ifdef RUNTIME_LOCK_ELISION
+TEST(Lock, Runtime_Elision) {
+    /// other tests could create threads before, then locks are already taken
+    t_lock lock = LOCK_INITIALIZER;
+    if (!lock_is_needed()) {
+        lock_acquire(&lock);
+        ASSERT_TRUE(lock_try_acquire(&lock));
+        lock_release(&lock);
+    }
+
+    /// thread isn't created by pthread_create, it's still seen
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, [](void*) { return 0; }, nullptr), thrd_success);
+    thrd_join(thread, nullptr);
+    ASSERT_TRUE(lock_is_needed());
+    lock_acquire(&lock);
+#ifdef THREAD_SAFE
+    ASSERT_FALSE(lock_try_acquire(&lock));
+#endif
+    lock_release(&lock);
+}
+#endif
+
+TEST(Lock, Try_Acquire) {
+    t_lock lock = LOCK_INITIALIZER;
+
+    lock_acquire(&lock);
+#ifdef THREAD_SAFE
+    ASSERT_FALSE(lock_try_acquire(&lock));
+#endif
+    lock_release(&lock);
+
+    ASSERT_TRUE(lock_try_acquire(&lock));
+    lock_release(&lock);
+}
+
+#ifdef THREAD_SAFE
+TEST(Lock, Mutual_Exclusion) {
+    static t_lock lock = LOCK_INITIALIZER;
+    static uint64_t counter = 0;
+    constexpr uint64_t threads_number = 8;
+    constexpr uint64_t iterations = 100000;
+
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < threads_number; ++t) {
+        threads.emplace_back([]() {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                lock_acquire(&lock);
+                /// not atomic on purpose, lost updates mean broken lock
+                uint64_t value = counter;
+                counter = value + 1;
+                lock_release(&lock);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(counter, threads_number * iterations);
+}
+#endif
+
+#if defined(LOCK_PROFILING) && defined(THREAD_SAFE)
+TEST(Lock, Profiling) {
+    static t_lock lock = LOCK_INITIALIZER;
+    __reset_lock_profile();
+    gLockProfilingEnabled = 1;
+
+    /// uncontended acquisition isn't timed
+    lock_set_site(LockSiteFree);
+    lock_acquire(&lock);
+    lock_release(&lock);
+    ASSERT_EQ(gLockProfile[LockSiteFree].acquisitions, 1);
+    ASSERT_EQ(gLockProfile[LockSiteFree].contended_acquisitions, 0);
+
+    lock_acquire(&lock);
+    std::thread waiter([]() {
+        lock_set_site(LockSiteMalloc);
+        lock_acquire(&lock);
+        lock_release(&lock);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    lock_release(&lock);
+    waiter.join();
+    gLockProfilingEnabled = 0;
+
+    t_lock_site_profile* profile = &gLockProfile[LockSiteMalloc];
+    ASSERT_EQ(profile->acquisitions, 1);
+    ASSERT_EQ(profile->contended_acquisitions, 1);
+    ASSERT_GE(profile->wait_time_ns, 1000000);
+    uint64_t waits = 0;
+    for (uint64_t i = 0; i < LOCK_PROFILE_HISTOGRAM_SIZE; ++i) {
+        waits += profile->wait_histogram[i];
+    }
+    ASSERT_EQ(waits, 1);
+
+    /// disabled profiling doesn't count
+    ASSERT_EQ(gLockProfile[LockSiteFree].acquisitions, 2);
+    lock_acquire(&lock);
+    lock_release(&lock);
+    ASSERT_EQ(gLockProfile[LockSiteFree].acquisitions, 2);
+    lock_set_site(LockSiteOther);
+}
+#endif
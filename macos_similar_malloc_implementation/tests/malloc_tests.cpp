@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <vector>
 
 extern "C" {
 #include "malloc_internal.h"
@@ -7,11 +8,39 @@ extern "C" {
 
 #define TEST_ZONE_SIZE 4096
 
+/// with TLSF small zone mapping ends with its control block
+#ifdef TLSF
+#define SMALL_ZONE_TOTAL_SIZE (SMALL_ZONE_SIZE - ZONE_HEADER_SIZE - sizeof(t_tlsf))
+#else
+#define SMALL_ZONE_TOTAL_SIZE (SMALL_ZONE_SIZE - ZONE_HEADER_SIZE)
+#endif
+
 static BYTE* test_zone = (BYTE*)mmap(0, TEST_ZONE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
                                      VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
 static BYTE* test_fully_occupied_zone = (BYTE*)mmap(0, TEST_ZONE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
                                                     VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
 
+TEST(Take_Mem_From_Free_Nodes, Empty_List) {
+    t_zone* zone = (t_zone*)test_zone;
+    bzero(test_zone, TEST_ZONE_SIZE);
+    zone->next = nullptr;
+    zone->total_size = TEST_ZONE_SIZE - ZONE_HEADER_SIZE;
+
+    BYTE* last_allocated_node = (BYTE*)zone + (zone->total_size + ZONE_HEADER_SIZE) - NODE_HEADER_SIZE - 16;
+    set_node_size(last_allocated_node, 16, Tiny);
+    set_prev_node_size(last_allocated_node, 16);
+    set_node_zone_start_offset(last_allocated_node, zone->total_size - NODE_HEADER_SIZE - 16);
+    set_next_free_node(last_allocated_node, 0);
+    set_node_available(last_allocated_node, FALSE);
+    set_node_allocation_type(last_allocated_node, Tiny);
+    zone->last_allocated_node = last_allocated_node; // there is no space for any other node
+
+    void* mem = take_memory_from_zone_list(zone, 16, 64, Small);
+    ASSERT_EQ(mem, nullptr);
+}
+
+/// these tests build single free node list by hand, segregated lists version is below
+#ifndef SEGREGATED_FREE_LISTS
 TEST(Split_Node, Check_Correct) {
     bzero(test_zone, TEST_ZONE_SIZE);
     t_zone* zone = (t_zone*)test_zone;
@@ -46,27 +75,6 @@ TEST(Split_Node, Check_Correct) {
     ASSERT_EQ(get_node_allocation_type(new_node), Tiny);
 }
 
-TEST(Take_Mem_From_Free_Nodes, Empty_List) {
-    t_zone* zone = (t_zone*)test_zone;
-    bzero(test_zone, TEST_ZONE_SIZE);
-    zone->next = nullptr;
-    zone->total_size = TEST_ZONE_SIZE - ZONE_HEADER_SIZE;
-    zone->first_free_node = nullptr;
-    zone->last_free_node = nullptr;
-
-    BYTE* last_allocated_node = (BYTE*)zone + (zone->total_size + ZONE_HEADER_SIZE) - NODE_HEADER_SIZE - 16;
-    set_node_size(last_allocated_node, 16, Tiny);
-    set_prev_node_size(last_allocated_node, 16);
-    set_node_zone_start_offset(last_allocated_node, zone->total_size - NODE_HEADER_SIZE - 16);
-    set_next_free_node(last_allocated_node, 0);
-    set_node_available(last_allocated_node, FALSE);
-    set_node_allocation_type(last_allocated_node, Tiny);
-    zone->last_allocated_node = last_allocated_node; // there is no space for any other node
-
-    void* mem = take_memory_from_zone_list(zone, 16, 64, Small);
-    ASSERT_EQ(mem, nullptr);
-}
-
 TEST(Take_Mem_From_Free_Nodes, Check_Without_Separated) {
     t_zone* occupied_zone = (t_zone*)test_fully_occupied_zone;
     occupied_zone->first_free_node = nullptr;
@@ -399,6 +407,7 @@ TEST(Take_Memory_From_Zone, Main_Check) {
         occupied_zone->next = zone;
         zone->next = nullptr;
 
+        update_zone_tail_size(zone);  /// zone is built by hand, summary isn't set
         void* mem = take_memory_from_zone_list(occupied_zone, 48, 64, Tiny);
         ASSERT_TRUE(mem != nullptr);
 
@@ -437,6 +446,7 @@ TEST(Take_Memory_From_Zone, Main_Check) {
         add_node_to_available_list(zone, node1);
         add_node_to_available_list(zone, node2);
 
+        update_zone_tail_size(zone);  /// zone is built by hand, summary isn't set
         void* mem = take_memory_from_zone_list(occupied_zone, 48, 64, Tiny);
         ASSERT_TRUE(mem != nullptr);
 
@@ -458,34 +468,225 @@ TEST(Take_Memory_From_Zone, Main_Check) {
         ASSERT_EQ(zone->total_size, TEST_ZONE_SIZE - sizeof(t_zone));
     }
 }
+#else
+/// builds nodes one after another from zone start and adds them to free lists in given order.
+/// If fill_tail is set, occupied last allocated node takes the rest of zone, so memory is taken only from free lists.
+static t_zone* build_test_zone(const std::vector<uint64_t>& sizes, std::vector<BYTE*>& nodes, bool fill_tail) {
+    bzero(test_zone, TEST_ZONE_SIZE);
+    t_zone* zone = (t_zone*)test_zone;
+    zone->total_size = TEST_ZONE_SIZE - ZONE_HEADER_SIZE;
+
+    BYTE* node = test_zone + ZONE_HEADER_SIZE;
+    uint64_t prev_size = 0;
+    nodes.clear();
+    for (uint64_t size : sizes) {
+        construct_node_header(zone, node, size, prev_size, Tiny);
+        nodes.push_back(node);
+        zone->last_allocated_node = node;
+        prev_size = size;
+        node += NODE_HEADER_SIZE + size;
+    }
+    if (fill_tail) {
+        uint64_t rest_size = (uint64_t)(test_zone + TEST_ZONE_SIZE - node) - NODE_HEADER_SIZE;
+        construct_node_header(zone, node, rest_size, prev_size, Tiny);
+        zone->last_allocated_node = node;
+    }
+    for (BYTE* free_node : nodes) {
+        add_node_to_available_list(zone, free_node);
+    }
+    update_zone_tail_size(zone);
+    return zone;
+}
+
+TEST(Split_Node, Check_Correct) {
+    std::vector<BYTE*> nodes;
+    t_zone* zone = build_test_zone({16, 128}, nodes, true);
+    BYTE* node = nodes[1];
+    delete_node_from_available_list(zone, node);
+
+    take_away_node_part_and_make_it_available(node, 48, zone, Tiny);
+    BYTE* new_node = node + NODE_HEADER_SIZE + 48;
+
+    ASSERT_EQ(get_node_size(node, Tiny), 48);
+    ASSERT_EQ(get_prev_node_size(node), 16);
+    ASSERT_EQ(get_node_zone_start_offset(node), ZONE_HEADER_SIZE + NODE_HEADER_SIZE + 16);
+    ASSERT_EQ(get_node_available(node), FALSE);
+
+    /// the rest goes to its own exact list
+    ASSERT_EQ(get_node_size(new_node, Tiny), 128 - NODE_HEADER_SIZE - 48);
+    ASSERT_EQ(get_prev_node_size(new_node), 48);
+    ASSERT_EQ((BYTE*)zone + get_node_zone_start_offset(new_node), new_node);
+    ASSERT_EQ(get_prev_node_size(get_next_node(zone, new_node)), 128 - NODE_HEADER_SIZE - 48);
+    ASSERT_EQ(zone->free_lists[to_free_list_index(64)], new_node);
+    ASSERT_EQ(zone->free_lists[to_free_list_index(16)], nodes[0]);
+    ASSERT_EQ(zone->free_lists_bitmap, (1u << to_free_list_index(16)) | (1u << to_free_list_index(64)));
+    ASSERT_EQ(get_node_available(new_node), TRUE);
+    ASSERT_EQ(get_node_allocation_type(new_node), Tiny);
+}
+
+TEST(Take_Mem_From_Free_Nodes, Check_Without_Separated) {
+    std::vector<BYTE*> nodes;
+
+    {
+        /// exact list, the last added node of it is taken
+        t_zone* zone = build_test_zone({32, 48, 64, 48}, nodes, true);
+        void* mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[3] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[3], Tiny), 48);
+        ASSERT_EQ(get_node_available(nodes[3]), FALSE);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(48)], nodes[1]);
+        ASSERT_EQ(get_next_free_node(zone, nodes[1]), nullptr);
+
+        mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[1] + NODE_HEADER_SIZE);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(48)], nullptr);
+        ASSERT_EQ(zone->free_lists_bitmap, (1u << to_free_list_index(32)) | (1u << to_free_list_index(64)));
+    }
+
+    {
+        /// node of bigger list isn't split if the rest is smaller than separate size
+        t_zone* zone = build_test_zone({32, 96}, nodes, true);
+        void* mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[1] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[1], Tiny), 96);
+        ASSERT_EQ(get_node_available(nodes[1]), FALSE);
+        ASSERT_EQ(zone->free_lists_bitmap, 1u << to_free_list_index(32));
+    }
+
+    {
+        /// power of two list: nodes smaller than required are skipped
+        t_zone* zone = build_test_zone({208, 144, 160}, nodes, true);
+        void* mem = take_memory_from_zone_list(zone, 176, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[0] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[0], Tiny), 208);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(176)], nodes[2]);
+        ASSERT_EQ(get_next_free_node(zone, nodes[2]), nodes[1]);
+        ASSERT_EQ(get_next_free_node(zone, nodes[1]), nullptr);
+    }
+}
+
+TEST(Take_Mem_From_Free_Nodes, Check_With_Separated) {
+    std::vector<BYTE*> nodes;
+
+    {
+        /// required size list is empty, node of the nearest bigger non empty list is split
+        t_zone* zone = build_test_zone({32, 160, 304}, nodes, true);
+        void* mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[1] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[1], Tiny), 48);
+        ASSERT_EQ(get_node_available(nodes[1]), FALSE);
+
+        BYTE* new_separated_node = nodes[1] + NODE_HEADER_SIZE + 48;
+        uint64_t new_separated_node_size = 160 - 48 - NODE_HEADER_SIZE;
+        ASSERT_EQ(get_node_size(new_separated_node, Tiny), new_separated_node_size);
+        ASSERT_EQ(get_prev_node_size(new_separated_node), 48);
+        ASSERT_EQ(get_prev_node_size(nodes[2]), new_separated_node_size);
+        ASSERT_EQ(get_node_available(new_separated_node), TRUE);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(new_separated_node_size)], new_separated_node);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(160)], nullptr);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(304)], nodes[2]);
+    }
+
+    {
+        /// only FREE_LISTS_FIT_ATTEMPTS nodes of required size list are checked,
+        /// then the node of bigger list is taken even if the required size list has fitting one
+        t_zone* zone = build_test_zone({400, 272, 272, 272, 272, 608}, nodes, true);
+        void* mem = take_memory_from_zone_list(zone, 304, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[5] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[5], Tiny), 304);
+        BYTE* new_separated_node = nodes[5] + NODE_HEADER_SIZE + 304;
+        ASSERT_EQ(get_node_size(new_separated_node, Tiny), 608 - 304 - NODE_HEADER_SIZE);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(304)], new_separated_node);
+        ASSERT_EQ(get_next_free_node(zone, new_separated_node), nodes[4]);
+
+        /// fitting node within the bound is taken from its list
+        delete_node_from_available_list(zone, nodes[4]);
+        delete_node_from_available_list(zone, new_separated_node);
+        mem = take_memory_from_zone_list(zone, 304, 64, Tiny);
+        ASSERT_EQ((BYTE*)mem, nodes[0] + NODE_HEADER_SIZE);
+        ASSERT_EQ(get_node_size(nodes[0], Tiny), 304);
+        ASSERT_EQ(get_node_size(nodes[0] + NODE_HEADER_SIZE + 304, Tiny), 400 - 304 - NODE_HEADER_SIZE);
+    }
+
+    {
+        /// nothing fits, zone is full
+        t_zone* zone = build_test_zone({272, 272, 48}, nodes, true);
+        ASSERT_EQ(take_memory_from_zone_list(zone, 304, 64, Tiny), nullptr);
+        ASSERT_EQ(zone->free_lists_bitmap, (1u << to_free_list_index(272)) | (1u << to_free_list_index(48)));
+    }
+}
+
+TEST(Take_Memory_From_Zone, Main_Check) {
+    std::vector<BYTE*> nodes;
+
+    {
+        /// check first occurrence
+        t_zone* zone = build_test_zone({}, nodes, false);
+        zone->last_allocated_node = nullptr;  /// zone is completely free
+        update_zone_tail_size(zone);
+        void* mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+
+        BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE;
+        ASSERT_EQ(node + NODE_HEADER_SIZE, (BYTE*)mem);
+        ASSERT_EQ(get_node_size(node, Tiny), 48);
+        ASSERT_EQ(get_prev_node_size(node), 0);
+        ASSERT_EQ(get_node_available(node), FALSE);
+        ASSERT_EQ(zone->last_allocated_node, node);
+    }
+
+    {
+        /// check with not suitable free nodes
+        t_zone* zone = build_test_zone({16, 32}, nodes, false);
+        void* mem = take_memory_from_zone_list(zone, 48, 64, Tiny);
+
+        BYTE* node = nodes[1] + NODE_HEADER_SIZE + 32;
+        ASSERT_EQ(node + NODE_HEADER_SIZE, (BYTE*)mem);
+        ASSERT_EQ(get_node_size(node, Tiny), 48);
+        ASSERT_EQ(get_prev_node_size(node), 32);
+        ASSERT_EQ(get_node_available(node), FALSE);
+        ASSERT_EQ(zone->last_allocated_node, node);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(16)], nodes[0]);
+        ASSERT_EQ(zone->free_lists[to_free_list_index(32)], nodes[1]);
+        ASSERT_EQ(zone->total_size, TEST_ZONE_SIZE - sizeof(t_zone));
+    }
+}
+#endif
 
+/// tiny allocations don't go to zones with TINY_SLABS, slabs are checked in slab tests
+#ifndef TINY_SLABS
 TEST(Malloc_Internal_State, Check_Init_Correct) {
     char* mem = (char*)__malloc(5);
 
     ASSERT_EQ(gInit, true);
-    ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
-    ASSERT_EQ(gMemoryZones.last_large_allocation, nullptr);
+    ASSERT_EQ(large_allocations_number(), 0);
 
     BYTE* last_allocated_node = (BYTE*)mem - NODE_HEADER_SIZE;
     ASSERT_EQ(gMemoryZones.first_tiny_zone->total_size, TINY_ZONE_SIZE - ZONE_HEADER_SIZE);
     ASSERT_EQ(last_allocated_node, gMemoryZones.first_tiny_zone->last_allocated_node);
     ASSERT_EQ(get_node_size(last_allocated_node, Tiny), 16);
+#ifndef SEGREGATED_FREE_LISTS
     ASSERT_EQ(gMemoryZones.first_tiny_zone->first_free_node, nullptr);
     ASSERT_EQ(gMemoryZones.first_tiny_zone->last_free_node, nullptr);
+#endif
     ASSERT_EQ(gMemoryZones.first_tiny_zone->next, nullptr);
 
     ASSERT_EQ(gMemoryZones.first_tiny_zone, gMemoryZones.last_tiny_zone);
 
-    ASSERT_EQ(gMemoryZones.first_small_zone->total_size, SMALL_ZONE_SIZE - ZONE_HEADER_SIZE);
+    ASSERT_EQ(gMemoryZones.first_small_zone->total_size, SMALL_ZONE_TOTAL_SIZE);
     ASSERT_EQ(gMemoryZones.first_small_zone->last_allocated_node, nullptr);
+#ifndef SEGREGATED_FREE_LISTS
     ASSERT_EQ(gMemoryZones.first_small_zone->first_free_node, nullptr);
     ASSERT_EQ(gMemoryZones.first_small_zone->last_free_node, nullptr);
+#endif
     ASSERT_EQ(gMemoryZones.first_small_zone->next, nullptr);
 
     ASSERT_EQ(gMemoryZones.first_small_zone, gMemoryZones.last_small_zone);
 
 }
 
+/// with ZONE_STATE_LISTS full zone leaves zone list, state lists are checked in free tests.
+/// With MEDIUM_CLASS sizes checked here as large ones are medium.
+#if !defined(ZONE_STATE_LISTS) && !defined(MEDIUM_CLASS)
 TEST(Malloc_Internal_State, Correct_Zone_Select) {
     __free_all();
     init(); // needed for global vars which use getpagesize();
@@ -505,7 +706,7 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
                   (TINY_ZONE_SIZE - sizeof(t_zone)) % (TINE_ALLOCATION_MAX_SIZE + NODE_HEADER_SIZE));
         ASSERT_EQ(first_tiny_zone->next, nullptr);
         ASSERT_EQ(gMemoryZones.first_small_zone->last_allocated_node, nullptr);
-        ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
+        ASSERT_EQ(large_allocations_number(), 0);
 
         mem = __malloc(TINE_ALLOCATION_MAX_SIZE);
         t_zone* second_tiny_zone = gMemoryZones.last_tiny_zone;
@@ -521,13 +722,13 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
         ASSERT_EQ(second_zone_available_size,
                   TINY_ZONE_SIZE - ZONE_HEADER_SIZE - NODE_HEADER_SIZE - TINE_ALLOCATION_MAX_SIZE);
         ASSERT_EQ(gMemoryZones.first_small_zone->last_allocated_node, nullptr);
-        ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
+        ASSERT_EQ(large_allocations_number(), 0);
     }
 
     {
         /// small zone choosing and adding correct
         void *mem = nullptr;
-        for (size_t i = 0; i < (SMALL_ZONE_SIZE - sizeof(t_zone)) / (SMALL_ALLOCATION_MAX_SIZE + NODE_HEADER_SIZE); ++i) {
+        for (size_t i = 0; i < SMALL_ZONE_TOTAL_SIZE / (SMALL_ALLOCATION_MAX_SIZE + NODE_HEADER_SIZE); ++i) {
             mem = __malloc(SMALL_ALLOCATION_MAX_SIZE);
         }
         BYTE* last_allocated_node = (BYTE*)mem - NODE_HEADER_SIZE;
@@ -537,9 +738,9 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
         uint64_t first_zone_occupied_size = (last_allocated_node + NODE_HEADER_SIZE + get_node_size(last_allocated_node, Small)) - (BYTE*)first_small_zone - ZONE_HEADER_SIZE;
         uint64_t first_zone_available_size = first_small_zone->total_size - first_zone_occupied_size;
         ASSERT_EQ(first_zone_available_size,
-                  (SMALL_ZONE_SIZE - ZONE_HEADER_SIZE) % (SMALL_ALLOCATION_MAX_SIZE + NODE_HEADER_SIZE));
+                  SMALL_ZONE_TOTAL_SIZE % (SMALL_ALLOCATION_MAX_SIZE + NODE_HEADER_SIZE));
         ASSERT_EQ(first_small_zone->next, nullptr);
-        ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
+        ASSERT_EQ(large_allocations_number(), 0);
 
         mem = __malloc(SMALL_ALLOCATION_MAX_SIZE);
         last_allocated_node = (BYTE*)mem - NODE_HEADER_SIZE;
@@ -550,8 +751,8 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
         ASSERT_FALSE(first_small_zone == second_small_zone);
         ASSERT_EQ(first_small_zone->next, second_small_zone);
         ASSERT_EQ(second_zone_available_size,
-                  SMALL_ZONE_SIZE - ZONE_HEADER_SIZE - SMALL_ALLOCATION_MAX_SIZE - NODE_HEADER_SIZE);
-        ASSERT_EQ(gMemoryZones.first_large_allocation, nullptr);
+                  SMALL_ZONE_TOTAL_SIZE - SMALL_ALLOCATION_MAX_SIZE - NODE_HEADER_SIZE);
+        ASSERT_EQ(large_allocations_number(), 0);
     }
 
     {
@@ -559,8 +760,10 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
         size_t mem_size = 2048 + 15 & ~15;
         void* mem = __malloc(mem_size);
 
-        t_zone* first_large_allocation = gMemoryZones.first_large_allocation;
         BYTE* allocated_node = (BYTE*)mem - NODE_HEADER_SIZE;
+        t_zone* first_large_allocation = (t_zone*)(allocated_node - ZONE_HEADER_SIZE);
+        ASSERT_TRUE(large_allocations_contains_user_memory(mem));
+        ASSERT_EQ(large_allocations_number(), 1);
 
         ASSERT_EQ(first_large_allocation->total_size, mem_size + gPageSize - mem_size % gPageSize - ZONE_HEADER_SIZE);
         ASSERT_EQ(allocated_node, first_large_allocation->last_allocated_node);
@@ -570,15 +773,246 @@ TEST(Malloc_Internal_State, Correct_Zone_Select) {
         mem_size = SMALL_ALLOCATION_MAX_SIZE + gPageSize;
         mem = __malloc(mem_size);
 
-        t_zone* second_large_allocation = gMemoryZones.last_large_allocation;
         allocated_node = (BYTE*)mem - NODE_HEADER_SIZE;
+        t_zone* second_large_allocation = (t_zone*)(allocated_node - ZONE_HEADER_SIZE);
+        ASSERT_TRUE(large_allocations_contains_user_memory(mem));
+        ASSERT_EQ(large_allocations_number(), 2);
 
         ASSERT_FALSE(first_large_allocation == second_large_allocation);
-        ASSERT_EQ(first_large_allocation->next, second_large_allocation);
         ASSERT_EQ(allocated_node, second_large_allocation->last_allocated_node);
         ASSERT_EQ(second_large_allocation->total_size, mem_size + gPageSize - mem_size % gPageSize - ZONE_HEADER_SIZE);
         ASSERT_EQ(get_node_size(allocated_node, Large), mem_size);
         ASSERT_EQ(get_node_allocation_type(allocated_node), Large);
     }
 }
+#endif
+
+
+TEST(Malloc_Internal_State, Zone_Summary) {
+    __free_all();
+    init();
+    t_zone* zone = gMemoryZones.first_tiny_zone;
+    ASSERT_EQ(zone->tail_size, zone->total_size);
+    ASSERT_EQ(zone->largest_free_size, 0);
+
+    void* mem1 = __malloc(16);
+    void* mem2 = __malloc(16);
+    uint64_t free_node_size = get_user_memory_size(mem1);
+    ASSERT_EQ(zone->tail_size, get_zone_not_used_mem_size(zone));
+    __free(mem1);
+    ASSERT_EQ(zone->largest_free_size, free_node_size);
+    ASSERT_TRUE(zone_may_fit(zone, free_node_size));
+
+    /// tail is used, free node is too small, so summary is lowered
+    void* mem3 = __malloc(TINE_ALLOCATION_MAX_SIZE);
+    uint64_t required_size = get_user_memory_size(mem3);
+    ASSERT_TRUE(zone->largest_free_size >= free_node_size);
+    ASSERT_TRUE(zone->largest_free_size < required_size);
+    ASSERT_EQ(zone->tail_size, get_zone_not_used_mem_size(zone));
+
+    ASSERT_TRUE(zone_may_fit(zone, zone->tail_size - NODE_HEADER_SIZE));
+    ASSERT_FALSE(zone_may_fit(zone, zone->tail_size));
+
+    __free(mem2);
+    __free(mem3);
+    ASSERT_EQ(zone->tail_size, zone->total_size);
+    ASSERT_EQ(zone->largest_free_size, 0);
+}
+#endif
+
+/// search in free nodes isn't exhaustive, so summary is lowered only to the bound search proves.
+#ifdef SEGREGATED_FREE_LISTS
+TEST(Take_Memory_From_Zone, Summary_Bound_Segregated) {
+    t_zone* zone = create_new_zone(TINY_ZONE_SIZE, Tiny, &gMemoryZones);
+    /// list is filled from its head, so the only fitting node is after FREE_LISTS_FIT_ATTEMPTS smaller ones
+    uint64_t sizes[] = {400, 272, 272, 272, 272};
+    BYTE* nodes[5];
+    BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE;
+    uint64_t prev_size = 0;
+    for (uint64_t i = 0; i < 5; ++i) {
+        construct_node_header(zone, node, sizes[i], prev_size, Tiny);
+        add_node_to_available_list(zone, node);
+        nodes[i] = node;
+        zone->last_allocated_node = node;
+        prev_size = sizes[i];
+        node += NODE_HEADER_SIZE + sizes[i];
+    }
+    update_zone_tail_size(zone);
+    ASSERT_EQ(zone->largest_free_size, 400);
+
+    /// fitting node isn't reached and memory is taken from the tail, but zone still may fit it
+    void* mem = take_memory_from_zone(zone, 304, TINY_SEPARATE_SIZE, Tiny);
+    ASSERT_EQ((BYTE*)mem, node + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->largest_free_size, 400);
+    ASSERT_TRUE(zone_may_fit(zone, 400));
+
+    /// short list is checked to its end, so nothing in it and in smaller lists fits
+    delete_node_from_available_list(zone, nodes[0]);
+    delete_node_from_available_list(zone, nodes[1]);
+    delete_node_from_available_list(zone, nodes[2]);
+    mem = take_memory_from_zone(zone, 304, TINY_SEPARATE_SIZE, Tiny);
+    ASSERT_NE(mem, nullptr);
+    ASSERT_EQ(zone->largest_free_size, 304 - 16);
+
+    munmap(zone, TINY_ZONE_SIZE);
+}
+#endif
+
+#ifdef TLSF
+TEST(Take_Memory_From_Zone, Summary_Bound_TLSF) {
+    t_zone* zone = create_new_zone(SMALL_ZONE_SIZE, Small, &gMemoryZones);
+    /// both nodes are in [1024, 1088) list, first one is too small for 1040
+    uint64_t sizes[] = {1072, 1024};
+    BYTE* nodes[2];
+    BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE;
+    uint64_t prev_size = 0;
+    for (uint64_t i = 0; i < 2; ++i) {
+        construct_node_header(zone, node, sizes[i], prev_size, Small);
+        add_node_to_available_list(zone, node);
+        nodes[i] = node;
+        zone->last_allocated_node = node;
+        prev_size = sizes[i];
+        node += NODE_HEADER_SIZE + sizes[i];
+    }
+    update_zone_tail_size(zone);
+
+    void* mem = take_memory_from_zone(zone, 1040, SMALL_SEPARATE_SIZE, Small);
+    ASSERT_EQ((BYTE*)mem, node + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->largest_free_size, 1088 - 16);
+    ASSERT_TRUE(zone->largest_free_size >= 1072);
+
+    /// rounded up list and the required size one are empty, so nothing fits
+    delete_node_from_available_list(zone, nodes[0]);
+    delete_node_from_available_list(zone, nodes[1]);
+    mem = take_memory_from_zone(zone, 1040, SMALL_SEPARATE_SIZE, Small);
+    ASSERT_NE(mem, nullptr);
+    ASSERT_EQ(zone->largest_free_size, 1040 - 16);
+
+    unmap_zone(zone);
+}
+#endif
+
+TEST(Malloc_Internal_State, Arena_Ownership) {
+    __free_all();
+    init();
+    t_memory_zones* arena = &gArenas[ARENAS_COUNT - 1];
+
+    void* tiny_mem = arena_malloc(arena, 16);
+    void* small_mem = arena_malloc(arena, TINE_ALLOCATION_MAX_SIZE + 1);
+    void* large_mem = arena_malloc(arena, LARGE_ALLOCATION_MIN_SIZE);
+    ASSERT_EQ(get_user_memory_arena(tiny_mem), arena);
+    ASSERT_EQ(get_user_memory_arena(small_mem), arena);
+    ASSERT_EQ(get_user_memory_arena(large_mem), arena);
+    t_allocation_type type;
+    ASSERT_EQ(find_user_memory_arena(large_mem, &type), arena);
+    ASSERT_EQ(type, Large);
+
+    free_user_memory(large_mem);
+    ASSERT_EQ(large_allocations_number(), 0);
+    free_user_memory(tiny_mem);
+#ifdef TINY_SLABS
+    ASSERT_EQ(arena->empty_slab_pages, get_slab_page(tiny_mem));
+#elif defined(ZONE_STATE_LISTS)
+    ASSERT_EQ(arena->first_empty_zones[Tiny]->last_allocated_node, nullptr);
+#else
+    ASSERT_EQ(arena->first_tiny_zone->last_allocated_node, nullptr);
+#endif
+
+    void* mem = __realloc(small_mem, TINE_ALLOCATION_MAX_SIZE * 2 + 1);
+    ASSERT_EQ(get_user_memory_arena(mem), arena);
+
+    ASSERT_EQ(get_user_memory_arena(__malloc(16)), &gMemoryZones);
+}
+
+TEST(Malloc_Internal_State, Large_Allocations_Shards) {
+    /// 64 kb aligned mappings (buddy blocks) are spread over all shards
+    uint64_t shard_hits[LARGE_ALLOCATIONS_SHARDS_COUNT] = {};
+    for (uint64_t i = 0; i < LARGE_ALLOCATIONS_SHARDS_COUNT * 8; ++i) {
+        ++shard_hits[to_large_allocations_shard_index((t_zone*)(0x7f0000000000 + i * 0x10000))];
+    }
+    for (auto hits : shard_hits) {
+        ASSERT_NE(hits, 0);
+    }
+}
+
+#ifdef MEDIUM_CLASS
+TEST(Malloc_Internal_State, Medium_Class) {
+    __free_all();
+    ASSERT_TRUE(init());
+
+    /// sizes between small and large go to medium zone, it's created on first use
+    ASSERT_EQ(gMemoryZones.first_medium_zone, nullptr);
+    BYTE* mem1 = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE + 1);
+    BYTE* mem2 = (BYTE*)__malloc(MEDIUM_ALLOCATION_MAX_SIZE);
+    t_zone* zone = gMemoryZones.first_medium_zone;
+    ASSERT_NE(zone, nullptr);
+    ASSERT_EQ(get_user_memory_allocation_type(mem1), Medium);
+    ASSERT_EQ(get_node_zone(mem2 - NODE_HEADER_SIZE), zone);
+    ASSERT_EQ(mem2, mem1 + SMALL_ALLOCATION_MAX_SIZE + 16 + NODE_HEADER_SIZE);
+    ASSERT_EQ(large_allocations_number(), 0);
+
+    void* large_mem = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+    ASSERT_EQ(get_user_memory_allocation_type(large_mem), Large);
+    ASSERT_EQ(large_allocations_number(), 1);
+
+    /// medium node is shrunk in place, freed one is reused without syscalls
+    ASSERT_EQ(__realloc(mem2, MEDIUM_ALLOCATION_MAX_SIZE / 2), mem2);
+    __free(mem2);
+    ASSERT_EQ(__malloc(4096), mem2);
+
+    __free(mem2);
+    __free(mem1);
+    __free(large_mem);
+    ASSERT_EQ(zone->last_allocated_node, nullptr);
+}
+#endif
 
+#ifdef HUGE_PAGES
+TEST(Malloc_Internal_State, Huge_Pages) {
+    __free_all();
+
+    /// class zones start on huge page boundary
+    BYTE* small_mem = (BYTE*)__malloc(SMALL_ALLOCATION_MAX_SIZE);
+    t_zone* zone = get_node_zone(small_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ((uint64_t)zone % HUGE_PAGE_SIZE, 0);
+    __free(small_mem);
+
+    /// large mapping from threshold is aligned and rounded to huge pages
+    const uint64_t size = HUGE_PAGES_LARGE_MIN_SIZE_DEFAULT * 2;
+    BYTE* large_mem = (BYTE*)__malloc(size);
+    zone = get_node_zone(large_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ((uint64_t)zone % HUGE_PAGE_SIZE, 0);
+    ASSERT_EQ((ZONE_HEADER_SIZE + zone->total_size) % HUGE_PAGE_SIZE, 0);
+    large_mem[size - 1] = 'a';
+
+    /// with threshold turned off it's rounded to usual pages, cached huge mapping isn't taken
+    __free_all();
+    gHugePagesLargeMinSize = 0;
+    large_mem = (BYTE*)__malloc(size);
+    zone = get_node_zone(large_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(ZONE_HEADER_SIZE + zone->total_size, calculate_zone_size(Large, size));
+    ASSERT_NE((ZONE_HEADER_SIZE + zone->total_size) % HUGE_PAGE_SIZE, 0);
+    __free(large_mem);
+    gHugePagesLargeMinSize = HUGE_PAGES_LARGE_MIN_SIZE_DEFAULT;
+
+    /// tiny zone is one huge page, with huge page zones off it's usual 1 mb zone
+    ASSERT_EQ(calculate_zone_size(Tiny, 16), HUGE_PAGE_SIZE);
+    gHugePagesZones = FALSE;
+    ASSERT_EQ(calculate_zone_size(Tiny, 16), TINY_ZONE_DEFAULT_SIZE);
+    zone = create_new_zone(TINY_ZONE_SIZE, Tiny, &gMemoryZones);
+    ASSERT_EQ(ZONE_HEADER_SIZE + zone->total_size, TINY_ZONE_DEFAULT_SIZE);
+    unmap_zone(zone);
+    gHugePagesZones = TRUE;
+}
+
+TEST(Malloc_Internal_State, Huge_Pages_Large_Allocations_Shards) {
+    /// huge page mappings are 2 mb aligned
+    uint64_t shard_hits[LARGE_ALLOCATIONS_SHARDS_COUNT] = {};
+    for (uint64_t i = 0; i < LARGE_ALLOCATIONS_SHARDS_COUNT * 8; ++i) {
+        ++shard_hits[to_large_allocations_shard_index((t_zone*)(0x7f0000000000 + i * HUGE_PAGE_SIZE))];
+    }
+    for (auto hits : shard_hits) {
+        ASSERT_NE(hits, 0);
+    }
+}
+#endif
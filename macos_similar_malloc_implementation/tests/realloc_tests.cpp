@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <array>
+#include <vector>
 
 extern "C" {
 #include "malloc_internal.h"
@@ -9,45 +10,130 @@ extern "C" {
 TEST(Realloc, Large) {
     __free_all();
 
-    void* mem = __malloc(SMALL_ALLOCATION_MAX_SIZE + 1);
+    void* mem = __malloc(LARGE_ALLOCATION_MIN_SIZE);
 
     void* mem1 = __realloc(mem, SMALL_ALLOCATION_MAX_SIZE);
     ASSERT_EQ(mem, mem1);
 
-    void* mem2 = __realloc(mem1, SMALL_ALLOCATION_MAX_SIZE + 2);
+    /// with LARGE_TRIM shrunk memory can lose its tail pages and move
+    void* mem2 = __realloc(mem1, LARGE_ALLOCATION_MIN_SIZE + 1);
+#ifndef LARGE_TRIM
     ASSERT_EQ(mem1, mem2);
+#endif
 
-    void* mem3 = __realloc(mem2, SMALL_ALLOCATION_MAX_SIZE * 16);
+    void* mem3 = __realloc(mem2, LARGE_ALLOCATION_MIN_SIZE * 16);
     ASSERT_FALSE(mem2 == mem3);
 
     void* mem4 = __realloc(mem3, 0);
     ASSERT_FALSE(mem3 == mem4);
 }
 
+#ifdef LARGE_REMAP
+TEST(Realloc, Large_Remap) {
+    __free_all();
+
+    /// bigger than buddy allocations, so it has own mapping
+    const uint64_t size = 0x800000;
+    BYTE* mem = (BYTE*)__malloc(size);
+    mem[0] = 'a';
+    mem[size - 1] = 'b';
+
+    /// mapping grows, pages keep their content
+    BYTE* grown_mem = (BYTE*)__realloc(mem, size * 4);
+    t_zone* zone = get_node_zone(grown_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(grown_mem, (BYTE*)zone + ZONE_HEADER_SIZE + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->total_size, calculate_zone_size(Large, size * 4) - ZONE_HEADER_SIZE);
+    ASSERT_EQ(get_user_memory_size(grown_mem), size * 4);
+    ASSERT_EQ(grown_mem[0], 'a');
+    ASSERT_EQ(grown_mem[size - 1], 'b');
+    ASSERT_EQ(large_allocations_number(), 1);
+    ASSERT_TRUE(zones_contains_user_memory(grown_mem));
+
+    /// mapping shrinks in place if the new one is less than half of it, with LARGE_TRIM on any shrink
+    ASSERT_EQ(__realloc(grown_mem, size * 3), grown_mem);
+#ifdef LARGE_TRIM
+    ASSERT_EQ(zone->total_size, calculate_zone_size(Large, size * 3) - ZONE_HEADER_SIZE);
+#else
+    ASSERT_EQ(zone->total_size, calculate_zone_size(Large, size * 4) - ZONE_HEADER_SIZE);
+#endif
+    ASSERT_EQ(__realloc(grown_mem, size), grown_mem);
+    ASSERT_EQ(zone->total_size, calculate_zone_size(Large, size) - ZONE_HEADER_SIZE);
+    ASSERT_EQ(grown_mem[size - 1], 'b');
+
+    __free(grown_mem);
+    ASSERT_EQ(large_allocations_number(), 0);
+}
+#endif
+
+#ifdef LARGE_TRIM
+TEST(Realloc, Large_Trim) {
+    __free_all();
+
+    /// bigger than buddy allocations, so it has own mapping
+    const uint64_t size = 0x800000;
+    BYTE* mem = (BYTE*)__malloc(size);
+    t_zone* zone = get_node_zone(mem - NODE_HEADER_SIZE);
+    mem[0] = 'a';
+
+    ASSERT_EQ(__realloc(mem, size / 8), mem);
+    ASSERT_EQ(zone->total_size, calculate_zone_size(Large, size / 8) - ZONE_HEADER_SIZE);
+    ASSERT_EQ(get_user_memory_size(mem), size / 8);
+    ASSERT_EQ(mem[0], 'a');
+
+    /// too small tail is kept
+    uint64_t total_size = zone->total_size;
+    ASSERT_EQ(__realloc(mem, size / 8 - LARGE_TRIM_MIN_SIZE / 2), mem);
+    ASSERT_EQ(zone->total_size, total_size);
+    ASSERT_TRUE(zones_contains_user_memory(mem));
+    __free(mem);
+
+#ifdef BUDDY_ALLOCATOR
+    /// buddy block keeps its lower part, upper halves go to free lists
+    t_buddy_allocator* allocator = &gBuddyAllocators[0];
+    BYTE* buddy_mem = (BYTE*)__malloc(BUDDY_MAX_ALLOCATION_SIZE / 2);
+    zone = get_node_zone(buddy_mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(__realloc(buddy_mem, BUDDY_MIN_ALLOCATION_SIZE), buddy_mem);
+    ASSERT_EQ(zone->total_size, BUDDY_PAGE_SIZE * 32 - ZONE_HEADER_SIZE);
+    ASSERT_EQ((BYTE*)allocator->free_blocks[5], (BYTE*)zone + BUDDY_PAGE_SIZE * 32);
+    ASSERT_EQ((BYTE*)allocator->free_blocks[9], (BYTE*)zone + BUDDY_PAGE_SIZE * 512);
+
+    /// freed block is merged back with trimmed halves
+    __free(buddy_mem);
+    ASSERT_EQ((BYTE*)allocator->free_blocks[10], (BYTE*)zone);
+#endif
+}
+#endif
+
+/// With TINY_SLABS tiny memory doesn't have nodes at all. With ZONE_STATE_LISTS full zone leaves zone list.
+#if !defined(TINY_SLABS) && !defined(ZONE_STATE_LISTS)
 TEST(Realloc, Tiny_Small) {
     __free_all();
 
-    constexpr uint64_t max_nodes_number_in_tiny_zone = (TINY_ZONE_SIZE - ZONE_HEADER_SIZE) / (16 + NODE_HEADER_SIZE);
-    std::array<void*, max_nodes_number_in_tiny_zone> ptr_arr1{};
-    std::array<void*, max_nodes_number_in_tiny_zone / 2> ptr_arr2{};
+    const uint64_t max_nodes_number_in_tiny_zone = (TINY_ZONE_SIZE - ZONE_HEADER_SIZE) / (16 + NODE_HEADER_SIZE);
+    /// nodes number is kept even (first node takes two places if needed), so every node has free node after it
+    const uint64_t nodes_number = max_nodes_number_in_tiny_zone & ~1ULL;
+    std::vector<void*> ptr_arr1(nodes_number);
+    std::vector<void*> ptr_arr2(nodes_number / 2);
 
     /// fill full zone
-    for (uint64_t i = 0; i < max_nodes_number_in_tiny_zone; ++i) {
+    ptr_arr1[0] = __malloc(max_nodes_number_in_tiny_zone % 2 == 0 ? 16 : 48);
+    for (uint64_t i = 1; i < nodes_number; ++i) {
         ptr_arr1[i] = __malloc(16);
     }
     ASSERT_EQ(gMemoryZones.first_tiny_zone, gMemoryZones.last_tiny_zone);
-    ASSERT_TRUE(get_zone_not_used_mem_size(gMemoryZones.first_tiny_zone) < 32);
+    uint64_t full_zone_not_used_mem_size = get_zone_not_used_mem_size(gMemoryZones.first_tiny_zone);
+    ASSERT_TRUE(full_zone_not_used_mem_size < 32);
 
     /// free trough one from the begin
-    for (uint64_t i = 1; i < max_nodes_number_in_tiny_zone; i+=2) {
+    for (uint64_t i = 1; i < nodes_number; i+=2) {
         __free(ptr_arr1[i]);
     }
 
     /// last node goes to not used space
-    ASSERT_TRUE(get_zone_not_used_mem_size(gMemoryZones.first_tiny_zone) > 32);
+    ASSERT_EQ(get_zone_not_used_mem_size(gMemoryZones.first_tiny_zone), full_zone_not_used_mem_size + 32);
 
     uint64_t j = 0;
-    for (uint64_t i = 0; i < max_nodes_number_in_tiny_zone; i+=2) {
+    for (uint64_t i = 0; i < nodes_number; i+=2) {
         ptr_arr2[j] = __realloc(ptr_arr1[i], 48);
         ++j;
     }
@@ -64,4 +150,5 @@ TEST(Realloc, Tiny_Small) {
 
     ptr_arr2[0] = __realloc(ptr_arr2[0], 16);
     ASSERT_EQ(get_zone_not_used_mem_size(gMemoryZones.first_tiny_zone), TINY_ZONE_SIZE - ZONE_HEADER_SIZE - NODE_HEADER_SIZE - 112);
-}
\ No newline at end of file
+}
+#endif
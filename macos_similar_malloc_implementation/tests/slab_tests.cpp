@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "malloc_internal.h"
+#include "utilities.h"
+}
+
+#ifdef TINY_SLABS
+
+TEST(Slab, Malloc_Free) {
+    __free_all();
+
+    /// slots of one size are packed without headers
+    BYTE* mem1 = (BYTE*)__malloc(16);
+    BYTE* mem2 = (BYTE*)__malloc(10);
+    ASSERT_TRUE(is_slab_memory(mem1));
+    ASSERT_EQ(mem2, mem1 + 16);
+    ASSERT_EQ(get_user_memory_size(mem2), 16);
+    ASSERT_EQ(get_user_memory_allocation_type(mem2), Tiny);
+    ASSERT_EQ(get_user_memory_arena(mem2), &gMemoryZones);
+
+    /// other size goes to its own page, small size isn't taken from slabs
+    BYTE* mem3 = (BYTE*)__malloc(TINE_ALLOCATION_MAX_SIZE);
+    ASSERT_EQ(get_slab_page(mem3)->slot_size, TINE_ALLOCATION_MAX_SIZE);
+    ASSERT_NE(get_slab_page(mem3), get_slab_page(mem1));
+    void* small_mem = __malloc(TINE_ALLOCATION_MAX_SIZE + 1);
+    ASSERT_FALSE(is_slab_memory(small_mem));
+
+    /// freed slot is taken again
+    __free(mem1);
+    ASSERT_EQ(__malloc(16), mem1);
+
+    __free(mem1);
+    __free(mem2);
+    __free(mem3);
+    __free(small_mem);
+}
+
+TEST(Slab, Pages) {
+    __free_all();
+
+    /// full page leaves list, next slot is taken from new page
+    const uint64_t slots_number = SLAB_PAGE_SIZE / 48;
+    BYTE* ptr_arr[slots_number + 1];
+    for (uint64_t i = 0; i < slots_number; ++i) {
+        ptr_arr[i] = (BYTE*)__malloc(48);
+        ASSERT_EQ(ptr_arr[i], ptr_arr[0] + i * 48);
+    }
+    t_slab_page* page = get_slab_page(ptr_arr[0]);
+    ASSERT_EQ(page->free_slots_number, 0);
+    ASSERT_EQ(gMemoryZones.slab_pages[2], nullptr);
+
+    ptr_arr[slots_number] = (BYTE*)__malloc(48);
+    ASSERT_NE(get_slab_page(ptr_arr[slots_number]), page);
+
+    /// page with freed slot is back in list
+    __free(ptr_arr[1]);
+    ASSERT_EQ(gMemoryZones.slab_pages[2], page);
+    ASSERT_EQ(page->free_slots_number, 1);
+
+    /// empty page can take other slot size
+    for (uint64_t i = 0; i < slots_number; ++i) {
+        if (i != 1) {
+            __free(ptr_arr[i]);
+        }
+    }
+    ASSERT_EQ(page->slot_size, 0);
+    ASSERT_EQ(gMemoryZones.empty_slab_pages, page);
+    ASSERT_EQ(__malloc(64), get_slab_page_memory(page));
+    ASSERT_EQ(page->slot_size, 64);
+}
+
+/// purged pages are dropped right away only on Linux, MADV_FREE keeps them until system takes them
+static BOOL slab_page_purged(t_slab_page* page) {
+#ifdef __linux__
+    unsigned char residency = 0;
+    mincore(get_slab_page_memory(page), SLAB_PAGE_SIZE, &residency);
+    return (residency & 1) == 0;
+#else
+    (void)page;
+    return TRUE;
+#endif
+}
+
+TEST(Slab, Purge_Empty_Pages) {
+    __free_all();
+
+    BYTE* mem1 = (BYTE*)__malloc(16);
+    BYTE* mem2 = (BYTE*)__malloc(32);
+    memset(mem1, 'a', 16);
+    memset(mem2, 'a', 32);
+    t_slab_page* page1 = get_slab_page(mem1);
+    t_slab_page* page2 = get_slab_page(mem2);
+    __free(mem1);
+    __free(mem2);
+    ASSERT_EQ(gMemoryZones.empty_slab_pages, page2);
+    ASSERT_EQ(page2->next, page1);
+
+#ifdef DECAY
+    /// empty pages are given back by decay pass only after decay time
+    arena_decay(&gMemoryZones, page1->free_since + gDecayTimeMs - 1);
+    ASSERT_NE(page1->free_since, DECAY_PURGED);
+    arena_decay(&gMemoryZones, page2->free_since + gDecayTimeMs);
+    ASSERT_EQ(page1->free_since, DECAY_PURGED);
+    ASSERT_EQ(page2->free_since, DECAY_PURGED);
+    ASSERT_TRUE(slab_page_purged(page1));
+#else
+    /// the first empty page is kept, the next one is given back right away
+#ifdef __linux__
+    ASSERT_FALSE(slab_page_purged(page1));
+#endif
+#endif
+    ASSERT_TRUE(slab_page_purged(page2));
+
+    /// purged page is reused
+    BYTE* mem = (BYTE*)__malloc(48);
+    ASSERT_EQ(mem, get_slab_page_memory(page2));
+#ifndef __APPLE__
+    ASSERT_EQ(mem[0], 0);
+#endif
+    __free(mem);
+}
+
+TEST(Slab, Contains_User_Memory) {
+    __free_all();
+
+    BYTE* mem = (BYTE*)__malloc(32);
+    ASSERT_TRUE(zones_contains_user_memory(mem));
+    ASSERT_FALSE(zones_contains_user_memory(mem + 16));
+    ASSERT_FALSE(zones_contains_user_memory(mem + 32));
+    t_allocation_type type;
+    ASSERT_EQ(find_user_memory_arena(mem, &type), &gMemoryZones);
+    ASSERT_EQ(type, Tiny);
+
+    __free(mem);
+    ASSERT_FALSE(zones_contains_user_memory(mem));
+}
+
+TEST(Slab, Realloc) {
+    __free_all();
+
+    BYTE* mem = (BYTE*)__malloc(32);
+    memset(mem, 'a', 32);
+    ASSERT_EQ(__realloc(mem, 20), mem);
+
+    BYTE* new_mem = (BYTE*)__realloc(mem, 100);
+    ASSERT_NE(new_mem, mem);
+    ASSERT_EQ(get_user_memory_size(new_mem), 112);
+    for (uint64_t i = 0; i < 32; ++i) {
+        ASSERT_EQ(new_mem[i], 'a');
+    }
+    ASSERT_FALSE(zones_contains_user_memory(mem));
+
+    BYTE* small_mem = (BYTE*)__realloc(new_mem, SMALL_ALLOCATION_MAX_SIZE);
+    ASSERT_FALSE(is_slab_memory(small_mem));
+    ASSERT_EQ(small_mem[31], 'a');
+    __free(small_mem);
+}
+
+#endif
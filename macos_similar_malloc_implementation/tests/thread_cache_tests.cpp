@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "malloc_internal.h"
+#include "utilities.h"
+}
+
+/// with SAFE_FREE every put goes through thread_cache_release, so fast path tests aren't applicable.
+/// With TINY_SLABS tiny memory is taken from slabs, not from zones checked here.
+#if !defined(SAFE_FREE) && !defined(TINY_SLABS)
+
+TEST(Thread_Cache, Take_Put) {
+    __free_all();
+    t_thread_cache cache{};
+
+    ASSERT_EQ(thread_cache_take(&cache, 16), nullptr);
+
+    void* mem = __malloc(20);
+    ASSERT_TRUE(thread_cache_put(&cache, mem));
+    ASSERT_EQ(cache.bins[1].first_node, (BYTE*)mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(cache.bins[1].nodes_number, 1);
+
+    /// cached node stays occupied for zones
+    ASSERT_EQ(get_node_available((BYTE*)mem - NODE_HEADER_SIZE), FALSE);
+
+    ASSERT_EQ(thread_cache_take(&cache, 16), nullptr);
+    ASSERT_EQ(thread_cache_take(&cache, 17), mem);
+    ASSERT_EQ(cache.bins[1].first_node, nullptr);
+    ASSERT_EQ(cache.bins[1].nodes_number, 0);
+
+    /// large and zero sizes aren't cached
+    void* large_mem = __malloc(LARGE_ALLOCATION_MIN_SIZE);
+    ASSERT_FALSE(thread_cache_put(&cache, large_mem));
+    ASSERT_EQ(thread_cache_take(&cache, 0), nullptr);
+    ASSERT_EQ(thread_cache_take(&cache, SMALL_ALLOCATION_MAX_SIZE + 1), nullptr);
+    __free(large_mem);
+    __free(mem);
+}
+
+TEST(Thread_Cache, Refill_Flush) {
+    __free_all();
+    t_thread_cache cache{};
+
+    void* mem = thread_cache_refill(&cache, &gMemoryZones, 64);
+    ASSERT_TRUE(mem != nullptr);
+    t_zone* zone = get_node_zone((BYTE*)mem - NODE_HEADER_SIZE);
+    ASSERT_EQ(cache.bins[3].nodes_number, THREAD_CACHE_BATCH_SIZE - 1);
+
+    for (uint64_t i = 0; i < THREAD_CACHE_BATCH_SIZE - 1; ++i) {
+        void* cached_mem = thread_cache_take(&cache, 64);
+        ASSERT_TRUE(cached_mem != nullptr);
+        ASSERT_TRUE(get_node_size((BYTE*)cached_mem - NODE_HEADER_SIZE, Tiny) >= 64);
+        ASSERT_TRUE(thread_cache_put(&cache, cached_mem));
+    }
+    ASSERT_TRUE(thread_cache_put(&cache, mem));
+    ASSERT_EQ(cache.bins[3].nodes_number, THREAD_CACHE_BATCH_SIZE);
+
+    thread_cache_flush(&cache);
+    ASSERT_EQ(cache.bins[3].nodes_number, 0);
+    ASSERT_EQ(zone->last_allocated_node, nullptr);
+}
+
+TEST(Thread_Cache, Release_Full_Bin) {
+    __free_all();
+    t_thread_cache cache{};
+
+    void* ptr_arr[THREAD_CACHE_BIN_CAPACITY + 1];
+    for (auto& ptr : ptr_arr) {
+        ptr = __malloc(256);
+    }
+    for (uint64_t i = 0; i < THREAD_CACHE_BIN_CAPACITY; ++i) {
+        ASSERT_TRUE(thread_cache_put(&cache, ptr_arr[i]));
+    }
+    ASSERT_FALSE(thread_cache_put(&cache, ptr_arr[THREAD_CACHE_BIN_CAPACITY]));
+
+    thread_cache_release(&cache, ptr_arr[THREAD_CACHE_BIN_CAPACITY]);
+    ASSERT_EQ(cache.bins[15].nodes_number, THREAD_CACHE_BIN_CAPACITY - THREAD_CACHE_BATCH_SIZE + 1);
+    ASSERT_EQ(cache.bins[15].first_node, (BYTE*)ptr_arr[THREAD_CACHE_BIN_CAPACITY] - NODE_HEADER_SIZE);
+}
+
+TEST(Thread_Cache, Drop_After_Free_All) {
+    __free_all();
+    t_thread_cache cache{};
+    cache.generation = gThreadCacheGeneration;
+
+    ASSERT_TRUE(thread_cache_put(&cache, __malloc(16)));
+    __free_all();
+    ASSERT_EQ(thread_cache_take(&cache, 16), nullptr);
+    ASSERT_EQ(cache.bins[0].nodes_number, 0);
+    ASSERT_TRUE(init());
+}
+
+#endif
@@ -124,8 +124,9 @@ TEST(List_Operations, Zone_List) {
     ASSERT_EQ(zone_list_end, nullptr);
 }
 
+#ifndef SEGREGATED_FREE_LISTS
 TEST(List_Operations, Node_List) {
-    t_zone* zone = gMemoryZones.first_tiny_zone;
+    t_zone* zone = create_new_zone(TINY_ZONE_SIZE, Tiny, &gMemoryZones);
     BYTE* node1 = (BYTE*)zone + ZONE_HEADER_SIZE;
     construct_node_header(zone, node1, 16, 0, Tiny);
 
@@ -252,4 +253,123 @@ TEST(List_Operations, Node_List) {
     ASSERT_EQ(get_prev_node(zone, node4), node3);
     ASSERT_EQ(get_prev_node(zone, node3), node2);
     ASSERT_EQ(get_prev_node(zone, node2), node1);
+    unmap_zone(zone);
 }
+#else
+TEST(List_Operations, Segregated_Node_List) {
+    t_zone* zone = create_new_zone(TINY_ZONE_SIZE, Tiny, &gMemoryZones);
+    uint64_t sizes[] = {16, 32, 48, 160, 144, 304};
+    BYTE* nodes[6];
+
+    BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE;
+    uint64_t prev_size = 0;
+    for (uint64_t i = 0; i < 6; ++i) {
+        construct_node_header(zone, node, sizes[i], prev_size, Tiny);
+        add_node_to_available_list(zone, node);
+        nodes[i] = node;
+        prev_size = sizes[i];
+        node += NODE_HEADER_SIZE + sizes[i];
+    }
+    zone->last_allocated_node = nodes[5];
+
+    /// 16 byte step lists up to 128, power of two ranges after
+    ASSERT_EQ(to_free_list_index(16), 0);
+    ASSERT_EQ(to_free_list_index(128), FREE_LISTS_EXACT_COUNT - 1);
+    ASSERT_EQ(to_free_list_index(144), FREE_LISTS_EXACT_COUNT);
+    ASSERT_EQ(to_free_list_index(256), FREE_LISTS_EXACT_COUNT + 1);
+    ASSERT_EQ(to_free_list_index(SMALL_ZONE_SIZE), FREE_LISTS_COUNT - 1);
+
+    ASSERT_EQ(zone->free_lists[0], nodes[0]);
+    ASSERT_EQ(zone->free_lists[1], nodes[1]);
+    ASSERT_EQ(zone->free_lists[2], nodes[2]);
+    ASSERT_EQ(zone->free_lists[FREE_LISTS_EXACT_COUNT], nodes[4]);
+    ASSERT_EQ(get_next_free_node(zone, nodes[4]), nodes[3]);
+    ASSERT_EQ(get_prev_free_node(zone, nodes[3]), nodes[4]);
+    ASSERT_EQ(zone->free_lists[FREE_LISTS_EXACT_COUNT + 1], nodes[5]);
+    ASSERT_EQ(zone->free_lists_bitmap, 0b111u | (0b11u << FREE_LISTS_EXACT_COUNT));
+
+    /// exact list
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 32, TINY_SEPARATE_SIZE, Tiny), nodes[1] + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->free_lists[1], nullptr);
+    ASSERT_EQ(zone->free_lists_bitmap & 0b10u, 0);
+
+    /// first node of power of two list doesn't fit, the next one does
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 160, TINY_SEPARATE_SIZE, Tiny), nodes[3] + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->free_lists[FREE_LISTS_EXACT_COUNT], nodes[4]);
+    ASSERT_EQ(get_next_free_node(zone, nodes[4]), nullptr);
+
+    /// empty list, node is taken from bigger one
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 64, TINY_SEPARATE_SIZE, Tiny), nodes[4] + NODE_HEADER_SIZE);
+    ASSERT_EQ(get_node_size(nodes[4], Tiny), 64);
+    BYTE* rest_node = nodes[4] + NODE_HEADER_SIZE + 64;
+    ASSERT_EQ(zone->free_lists[to_free_list_index(144 - 64 - NODE_HEADER_SIZE)], rest_node);
+
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 512, TINY_SEPARATE_SIZE, Tiny), nullptr);
+
+    delete_node_from_available_list(zone, nodes[0]);
+    delete_node_from_available_list(zone, nodes[2]);
+    delete_node_from_available_list(zone, rest_node);
+    delete_node_from_available_list(zone, nodes[5]);
+    ASSERT_EQ(zone->free_lists_bitmap, 0);
+    munmap(zone, TINY_ZONE_SIZE);
+}
+#endif
+
+#ifdef TLSF
+TEST(List_Operations, TLSF_Node_List) {
+    t_zone* zone = create_new_zone(SMALL_ZONE_SIZE, Small, &gMemoryZones);
+    ASSERT_EQ((BYTE*)zone->tlsf, (BYTE*)zone + SMALL_ZONE_SIZE - sizeof(t_tlsf));
+    ASSERT_EQ(get_zone_mapping_size(zone), SMALL_ZONE_SIZE);
+
+    /// 16 byte step up to TLSF_SMALL_SIZE, TLSF_SL_COUNT lists per power of two after
+    uint64_t fl, sl;
+    tlsf_mapping(144, &fl, &sl);
+    ASSERT_EQ(fl, 0);
+    ASSERT_EQ(sl, 9);
+    tlsf_mapping(TLSF_SMALL_SIZE, &fl, &sl);
+    ASSERT_EQ(fl, 1);
+    ASSERT_EQ(sl, 0);
+    tlsf_mapping(TLSF_SMALL_SIZE * 2 - 16, &fl, &sl);
+    ASSERT_EQ(fl, 1);
+    ASSERT_EQ(sl, TLSF_SL_COUNT - 1);
+    tlsf_mapping(1024 + 64, &fl, &sl);
+    ASSERT_EQ(fl, 3);
+    ASSERT_EQ(sl, 1);
+    tlsf_mapping(zone->total_size, &fl, &sl);
+    ASSERT_EQ(fl, TLSF_FL_COUNT - 1);
+    ASSERT_EQ(tlsf_round_up(144), 144);
+    ASSERT_EQ(tlsf_round_up(272), 287);
+
+    uint64_t sizes[] = {144, 272, 288, 1072};
+    BYTE* nodes[4];
+    BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE;
+    uint64_t prev_size = 0;
+    for (uint64_t i = 0; i < 4; ++i) {
+        construct_node_header(zone, node, sizes[i], prev_size, Small);
+        add_node_to_available_list(zone, node);
+        nodes[i] = node;
+        prev_size = sizes[i];
+        node += NODE_HEADER_SIZE + sizes[i];
+    }
+    zone->last_allocated_node = nodes[3];
+    ASSERT_EQ(zone->tlsf->fl_bitmap, 0b1011u);
+    ASSERT_EQ(zone->tlsf->sl_bitmaps[0], 1u << 9);
+    ASSERT_EQ(zone->tlsf->sl_bitmaps[1], 0b110u);
+    ASSERT_EQ(zone->tlsf->sl_bitmaps[3], 0b1u);
+
+    /// exact lists
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 144, SMALL_SEPARATE_SIZE, Small), nodes[0] + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->tlsf->fl_bitmap, 0b1010u);
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 272, SMALL_SEPARATE_SIZE, Small), nodes[1] + NODE_HEADER_SIZE);
+
+    /// 1040 is rounded up to [1088, 1152) list, it's empty, so the first node of its own list is checked
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 1040, SMALL_SEPARATE_SIZE, Small), nodes[3] + NODE_HEADER_SIZE);
+
+    /// empty list, node is taken from the next non empty one
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 272, SMALL_SEPARATE_SIZE, Small), nodes[2] + NODE_HEADER_SIZE);
+    ASSERT_EQ(zone->tlsf->fl_bitmap, 0);
+    ASSERT_EQ(take_memory_from_free_nodes(zone, 16, SMALL_SEPARATE_SIZE, Small), nullptr);
+
+    unmap_zone(zone);
+}
+#endif
@@ -0,0 +1,182 @@
+#include "malloc_internal.h"
+#include "utilities.h"
+
+uint64_t gThreadCacheGeneration = 0;
+
+static inline BYTE* get_next_cached_node(BYTE* node) {
+    return *(BYTE**)(node + NODE_HEADER_SIZE);
+}
+
+static inline void set_next_cached_node(BYTE* node, BYTE* next_node) {
+    *(BYTE**)(node + NODE_HEADER_SIZE) = next_node;
+}
+
+static inline void push_node_to_bin(t_thread_cache_bin* bin, BYTE* node) {
+    set_next_cached_node(node, bin->first_node);
+    bin->first_node = node;
+    ++bin->nodes_number;
+}
+
+static inline BYTE* pop_node_from_bin(t_thread_cache_bin* bin) {
+    BYTE* node = bin->first_node;
+    bin->first_node = get_next_cached_node(node);
+    --bin->nodes_number;
+    return node;
+}
+
+/// all nodes in cache become invalid after free_all, so we just forget about them.
+static inline void check_generation(t_thread_cache* cache) {
+    uint64_t generation = __atomic_load_n(&gThreadCacheGeneration, __ATOMIC_ACQUIRE);
+    if (cache->generation != generation) {
+        bzero(cache->bins, sizeof(cache->bins));
+        cache->generation = generation;
+    }
+}
+
+/// returns bin index for tiny and small sizes or -1 if size can't be cached.
+static inline int64_t to_bin_index(uint64_t size) {
+    if (size == 0 || size > SMALL_ALLOCATION_MAX_SIZE) {
+        return -1;
+    }
+    return (int64_t)((size + 15) / 16) - 1;
+}
+
+static inline int64_t user_memory_to_bin_index(void* ptr) {
+    if (get_user_memory_allocation_type(ptr) == Large) {
+        return -1;
+    }
+    return to_bin_index(get_user_memory_size(ptr));
+}
+
+void* thread_cache_take(t_thread_cache* cache, size_t required_size) {
+    int64_t bin_index = to_bin_index(required_size);
+    if (bin_index < 0) {
+        return NULL;
+    }
+    check_generation(cache);
+
+    t_thread_cache_bin* bin = &cache->bins[bin_index];
+    if (bin->first_node == NULL) {
+        return NULL;
+    }
+    return (void*)(pop_node_from_bin(bin) + NODE_HEADER_SIZE);
+}
+
+BOOL thread_cache_put(t_thread_cache* cache, void* ptr) {
+#ifdef SAFE_FREE
+    /// ptr has to be checked under allocator lock first, so it goes through thread_cache_release
+    (void)cache;
+    (void)ptr;
+    return FALSE;
+#else
+    if (ptr == NULL) {
+        return TRUE;
+    }
+    int64_t bin_index = user_memory_to_bin_index(ptr);
+    if (bin_index < 0) {
+        return FALSE;
+    }
+    check_generation(cache);
+
+    t_thread_cache_bin* bin = &cache->bins[bin_index];
+    if (bin->nodes_number >= THREAD_CACHE_BIN_CAPACITY) {
+        return FALSE;
+    }
+    push_node_to_bin(bin, (BYTE*)ptr - NODE_HEADER_SIZE);
+    return TRUE;
+#endif
+}
+
+/// takes memory from arena under its lock, a batch of nodes goes to cache.
+void* thread_cache_refill(t_thread_cache* cache, t_memory_zones* arena, size_t required_size) {
+    void* mem;
+    int64_t bin_index = to_bin_index(required_size);
+    if (bin_index < 0) {
+        arena_lock_acquire(arena);
+        mem = arena_malloc(arena, required_size);
+        arena_lock_release(arena);
+        return mem;
+    }
+    check_generation(cache);
+
+    /// all batch nodes are taken with the same aligned size, so they are able to serve any request from this bin
+    uint64_t aligned_size = (uint64_t)(bin_index + 1) * 16;
+    t_thread_cache_bin* bin = &cache->bins[bin_index];
+    arena_lock_acquire(arena);
+    for (uint64_t i = 1; i < THREAD_CACHE_BATCH_SIZE && bin->nodes_number < THREAD_CACHE_BIN_CAPACITY; ++i) {
+        mem = arena_malloc(arena, aligned_size);
+        if (!mem) {
+            break;
+        }
+        push_node_to_bin(bin, (BYTE*)mem - NODE_HEADER_SIZE);
+    }
+    mem = arena_malloc(arena, aligned_size);
+    arena_lock_release(arena);
+    return mem;
+}
+
+/// cached nodes can belong to different arenas, arena lock is switched only when next node arena differs.
+static void flush_bin(t_thread_cache_bin* bin, uint64_t nodes_number) {
+    t_memory_zones* locked_arena = NULL;
+    while (bin->first_node != NULL && nodes_number > 0) {
+        BYTE* node = pop_node_from_bin(bin);
+        t_memory_zones* arena = get_user_memory_arena(node + NODE_HEADER_SIZE);
+        if (arena != locked_arena) {
+            if (locked_arena) {
+                arena_lock_release(locked_arena);
+            }
+            arena_lock_acquire(arena);
+            locked_arena = arena;
+        }
+        free_user_memory(node + NODE_HEADER_SIZE);
+        --nodes_number;
+    }
+    if (locked_arena) {
+        arena_lock_release(locked_arena);
+    }
+}
+
+/// should be called when thread_cache_put failed.
+/// if ptr can be cached, but its bin is full, we flush a batch of nodes and cache ptr, otherwise ptr is freed.
+void thread_cache_release(t_thread_cache* cache, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+#ifdef SAFE_FREE
+    t_allocation_type type;
+    t_memory_zones* arena = find_user_memory_arena(ptr, &type);
+    if (!arena) {
+        return;
+    }
+#else
+    t_memory_zones* arena = get_user_memory_arena(ptr);
+    t_allocation_type type = get_user_memory_allocation_type(ptr);
+#endif
+    /// large allocations don't need arena lock, __free checks them under shard lock (SAFE_FREE)
+    if (type == Large) {
+        __free(ptr);
+        return;
+    }
+    int64_t bin_index = user_memory_to_bin_index(ptr);
+    if (bin_index < 0) {
+        arena_lock_acquire(arena);
+        __free(ptr);
+        arena_lock_release(arena);
+        return;
+    }
+    check_generation(cache);
+
+    t_thread_cache_bin* bin = &cache->bins[bin_index];
+    if (bin->nodes_number >= THREAD_CACHE_BIN_CAPACITY) {
+        flush_bin(bin, THREAD_CACHE_BATCH_SIZE);
+    }
+    push_node_to_bin(bin, (BYTE*)ptr - NODE_HEADER_SIZE);
+}
+
+/// returns all cached nodes to zones.
+void thread_cache_flush(t_thread_cache* cache) {
+    check_generation(cache);
+    for (uint64_t i = 0; i < THREAD_CACHE_BINS_COUNT; ++i) {
+        flush_bin(&cache->bins[i], cache->bins[i].nodes_number);
+    }
+}
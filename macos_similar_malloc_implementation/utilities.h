@@ -23,6 +23,12 @@
 #define MASK_NODE_AVAILABLE 0x0000000000000004
 #define SHIFT_NODE_AVAILABLE 2
 
+#define MASK_NODE_DEFERRED 0x0000000000000008
+#define SHIFT_NODE_DEFERRED 3
+
+#define MASK_NODE_PURGED 0x0000000000000010
+#define SHIFT_NODE_PURGED 4
+
 #define MASK_NODE_TYPE 0x0000000000000003
 #define SHIFT_NODE_TYPE 0
 
@@ -100,6 +106,46 @@ static inline void set_node_available(BYTE* node_header, BOOL available) {
     set((uint64_t*)node_header + 1, MASK_NODE_AVAILABLE, SHIFT_NODE_AVAILABLE, (uint64_t)available);
 }
 
+static inline BOOL get_node_deferred(const BYTE* node_header) {
+    return (BOOL)get(*((uint64_t*)node_header + 1), MASK_NODE_DEFERRED, SHIFT_NODE_DEFERRED);
+}
+
+static inline void set_node_deferred(BYTE* node_header, BOOL deferred) {
+    set((uint64_t*)node_header + 1, MASK_NODE_DEFERRED, SHIFT_NODE_DEFERRED, (uint64_t)deferred);
+}
+
+#ifdef PURGE_FREE_SPANS
+static inline BOOL get_node_purged(const BYTE* node_header) {
+    return (BOOL)get(*((uint64_t*)node_header + 1), MASK_NODE_PURGED, SHIFT_NODE_PURGED);
+}
+
+static inline void set_node_purged(BYTE* node_header, BOOL purged) {
+    set((uint64_t*)node_header + 1, MASK_NODE_PURGED, SHIFT_NODE_PURGED, (uint64_t)purged);
+}
+
+static inline BYTE* page_floor(BYTE* ptr) {
+    return (BYTE*)((uint64_t)ptr & ~(uint64_t)(gPageSize - 1));
+}
+
+static inline BYTE* page_ceil(BYTE* ptr) {
+    return page_floor(ptr + gPageSize - 1);
+}
+
+/// whole pages from start to user memory end are purged or never used, they are reported for calloc.
+static inline void report_purged_memory(BYTE* start, BYTE* user_memory_end) {
+#ifdef PURGED_MEMORY_IS_ZEROED
+    BYTE* end = page_floor(user_memory_end);
+    if (start < end) {
+        tPurgedMemory.start = start;
+        tPurgedMemory.end = end;
+    }
+#else
+    (void)start;
+    (void)user_memory_end;
+#endif
+}
+#endif
+
 static inline t_allocation_type get_node_allocation_type(const BYTE* node_header) {
     return (t_allocation_type)get(*((uint64_t*)node_header + 1), MASK_NODE_TYPE, SHIFT_NODE_TYPE);
 }
@@ -164,6 +210,10 @@ static inline void construct_node_header(t_zone* zone,
     set_prev_node_size(node, prev_node_size);
     set_node_zone_start_offset(node, node - (BYTE*)zone);
     set_node_available(node, FALSE);
+    set_node_deferred(node, FALSE);
+#ifdef PURGE_FREE_SPANS
+    set_node_purged(node, FALSE);
+#endif
     set_node_allocation_type(node, type);
 }
 
@@ -196,7 +246,215 @@ static inline t_large_node_representation get_large_node_representation(BYTE* no
     return node_representation;
 }
 
-static inline void add_node_to_available_list(t_zone* zone, BYTE* node_to_add) {
+/// returns zone of any occupied node, for large node it's its own zone.
+static inline t_zone* get_node_zone(BYTE* node) {
+    if (get_node_allocation_type(node) == Large) {
+        return (t_zone*)(node - ZONE_HEADER_SIZE);
+    }
+    return (t_zone*)(node - get_node_zone_start_offset(node));
+}
+
+#ifdef TINY_SLABS
+static inline BOOL is_slab_memory(void* ptr) {
+    BYTE* region = __atomic_load_n(&gSlabRegion, __ATOMIC_RELAXED);
+    return region != NULL && (BYTE*)ptr >= region && (BYTE*)ptr < region + SLAB_REGION_SIZE;
+}
+
+static inline t_slab_page* get_slab_page(void* ptr) {
+    return &gSlabPages[((BYTE*)ptr - gSlabRegion) / SLAB_PAGE_SIZE];
+}
+
+static inline BYTE* get_slab_page_memory(t_slab_page* page) {
+    return gSlabRegion + (uint64_t)(page - gSlabPages) * SLAB_PAGE_SIZE;
+}
+
+static inline uint64_t get_slab_slot_index(t_slab_page* page, void* ptr) {
+    return (uint64_t)((BYTE*)ptr - get_slab_page_memory(page)) / page->slot_size;
+}
+#endif
+
+/// user memory helpers work both for nodes and slab slots, which don't have node header.
+static inline t_memory_zones* get_user_memory_arena(void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        return get_slab_page(ptr)->arena;
+    }
+#endif
+    return get_node_zone((BYTE*)ptr - NODE_HEADER_SIZE)->arena;
+}
+
+static inline uint64_t get_user_memory_size(void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        return get_slab_page(ptr)->slot_size;
+    }
+#endif
+    BYTE* node = (BYTE*)ptr - NODE_HEADER_SIZE;
+    return get_node_size(node, get_node_allocation_type(node));
+}
+
+static inline t_allocation_type get_user_memory_allocation_type(void* ptr) {
+#ifdef TINY_SLABS
+    if (is_slab_memory(ptr)) {
+        return Tiny;
+    }
+#endif
+    return get_node_allocation_type((BYTE*)ptr - NODE_HEADER_SIZE);
+}
+
+/// Zone summary lets zone list walk skip zone without touching its nodes.
+/// largest_free_size is raised when node is added to free list and lowered only when search in free nodes fails
+/// to what the search proves, so it's an upper bound of free node size. tail_size is exact, it's updated after every zone change.
+/// Summary is read without zone lock (FINE_GRAINED_LOCKS), stale value only makes malloc look at zone in vain
+/// or skip it once.
+static inline void raise_zone_largest_free_size(t_zone* zone, uint64_t size) {
+    if (size > zone->largest_free_size) {
+        __atomic_store_n(&zone->largest_free_size, size, __ATOMIC_RELAXED);
+    }
+}
+
+#ifdef TLSF
+/// size is multiple of 16 and isn't 0.
+static inline void tlsf_mapping(uint64_t size, uint64_t* fl, uint64_t* sl) {
+    if (size < TLSF_SMALL_SIZE) {
+        *fl = 0;
+        *sl = size / 16;
+        return;
+    }
+    uint64_t size_log2 = 63 - (uint64_t)__builtin_clzll(size);
+    *fl = size_log2 - TLSF_FL_SHIFT + 1;
+    *sl = (size >> (size_log2 - TLSF_SL_COUNT_LOG2)) ^ TLSF_SL_COUNT;
+}
+
+/// size is rounded up to the next second level list, so every node of found list fits it.
+static inline uint64_t tlsf_round_up(uint64_t size) {
+    if (size < TLSF_SMALL_SIZE) {
+        return size;
+    }
+    uint64_t size_log2 = 63 - (uint64_t)__builtin_clzll(size);
+    return size + (1ull << (size_log2 - TLSF_SL_COUNT_LOG2)) - 1;
+}
+
+/// first node of the smallest non empty list starting from [fl][sl] or NULL.
+static inline BYTE* tlsf_find_suitable(t_tlsf* tlsf, uint64_t fl, uint64_t sl) {
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL;
+    }
+    uint32_t sl_bitmap = tlsf->sl_bitmaps[fl] & (~0u << sl);
+    if (sl_bitmap == 0) {
+        uint32_t fl_bitmap = fl + 1 < TLSF_FL_COUNT ? tlsf->fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (fl_bitmap == 0) {
+            return NULL;
+        }
+        fl = (uint64_t)__builtin_ctz(fl_bitmap);
+        sl_bitmap = tlsf->sl_bitmaps[fl];
+    }
+    return tlsf->free_lists[fl][__builtin_ctz(sl_bitmap)];
+}
+
+static inline void tlsf_add_node(t_zone* zone, BYTE* node_to_add) {
+    uint64_t size = get_node_size(node_to_add, Small);
+    uint64_t fl, sl;
+    tlsf_mapping(size, &fl, &sl);
+    BYTE* first_node = zone->tlsf->free_lists[fl][sl];
+
+    set_prev_free_node(node_to_add, NULL);
+    set_next_free_node(node_to_add, first_node);
+    if (first_node != NULL) {
+        set_prev_free_node(first_node, node_to_add);
+    }
+    zone->tlsf->free_lists[fl][sl] = node_to_add;
+    zone->tlsf->fl_bitmap |= 1u << fl;
+    zone->tlsf->sl_bitmaps[fl] |= 1u << sl;
+    set_node_available(node_to_add, TRUE);
+    raise_zone_largest_free_size(zone, size);
+}
+
+static inline void tlsf_delete_node(t_zone* zone, BYTE* node_to_delete) {
+    uint64_t fl, sl;
+    tlsf_mapping(get_node_size(node_to_delete, Small), &fl, &sl);
+    BYTE* prev_node = get_prev_free_node(zone, node_to_delete);
+    BYTE* next_node = get_next_free_node(zone, node_to_delete);
+
+    if (prev_node == NULL) {
+        zone->tlsf->free_lists[fl][sl] = next_node;
+        if (next_node == NULL) {
+            zone->tlsf->sl_bitmaps[fl] &= ~(1u << sl);
+            if (zone->tlsf->sl_bitmaps[fl] == 0) {
+                zone->tlsf->fl_bitmap &= ~(1u << fl);
+            }
+        }
+    }
+    else {
+        set_next_free_node(prev_node, next_node);
+    }
+    if (next_node != NULL) {
+        set_prev_free_node(next_node, prev_node);
+    }
+
+    set_prev_free_node(node_to_delete, NULL);
+    set_next_free_node(node_to_delete, NULL);
+    set_node_available(node_to_delete, FALSE);
+}
+#endif
+
+#ifdef SEGREGATED_FREE_LISTS
+/// size is multiple of 16 and isn't 0.
+static inline uint64_t to_free_list_index(uint64_t size) {
+    if (size <= TINE_ALLOCATION_MAX_SIZE) {
+        return size / 16 - 1;
+    }
+    /// (128, 256) goes to FREE_LISTS_EXACT_COUNT, [256, 512) to next one, etc.
+    uint64_t index = FREE_LISTS_EXACT_COUNT + (63 - (uint64_t)__builtin_clzll(size)) - 7;
+    return index < FREE_LISTS_COUNT ? index : FREE_LISTS_COUNT - 1;
+}
+
+/// free node size shouldn't be changed while it's in list, its list is found by size.
+static inline void add_node_to_free_list(t_zone* zone, BYTE* node_to_add) {
+    uint64_t index = to_free_list_index(get_node_size(node_to_add, get_node_allocation_type(node_to_add)));
+    BYTE* first_node = zone->free_lists[index];
+
+    set_prev_free_node(node_to_add, NULL);
+    set_next_free_node(node_to_add, first_node);
+    if (first_node != NULL) {
+        set_prev_free_node(first_node, node_to_add);
+    }
+    zone->free_lists[index] = node_to_add;
+    zone->free_lists_bitmap |= 1u << index;
+    set_node_available(node_to_add, TRUE);
+    raise_zone_largest_free_size(zone, get_node_size(node_to_add, get_node_allocation_type(node_to_add)));
+}
+
+static inline void delete_node_from_free_list(t_zone* zone, BYTE* node_to_delete) {
+    uint64_t index = to_free_list_index(get_node_size(node_to_delete, get_node_allocation_type(node_to_delete)));
+    BYTE* prev_node = get_prev_free_node(zone, node_to_delete);
+    BYTE* next_node = get_next_free_node(zone, node_to_delete);
+
+    if (prev_node == NULL) {
+        zone->free_lists[index] = next_node;
+        if (next_node == NULL) {
+            zone->free_lists_bitmap &= ~(1u << index);
+        }
+    }
+    else {
+        set_next_free_node(prev_node, next_node);
+    }
+    if (next_node != NULL) {
+        set_prev_free_node(next_node, prev_node);
+    }
+
+    set_prev_free_node(node_to_delete, NULL);
+    set_next_free_node(node_to_delete, NULL);
+    set_node_available(node_to_delete, FALSE);
+}
+
+static inline void clear_free_list(t_zone* zone) {
+    bzero(zone->free_lists, sizeof(zone->free_lists));
+    zone->free_lists_bitmap = 0;
+    __atomic_store_n(&zone->largest_free_size, 0, __ATOMIC_RELAXED);
+}
+#else
+static inline void add_node_to_free_list(t_zone* zone, BYTE* node_to_add) {
     if (zone->first_free_node == NULL) {
         set_prev_free_node(node_to_add, NULL);
         set_next_free_node(node_to_add, NULL);
@@ -210,9 +468,10 @@ static inline void add_node_to_available_list(t_zone* zone, BYTE* node_to_add) {
         zone->last_free_node = node_to_add;
     }
     set_node_available(node_to_add, TRUE);
+    raise_zone_largest_free_size(zone, get_node_size(node_to_add, get_node_allocation_type(node_to_add)));
 }
 
-static inline void delete_node_from_available_list(t_zone* zone, BYTE* node_to_delete) {
+static inline void delete_node_from_free_list(t_zone* zone, BYTE* node_to_delete) {
     if (zone->first_free_node == zone->last_free_node) {
         zone->first_free_node = NULL;
         zone->last_free_node = NULL;
@@ -242,6 +501,137 @@ static inline void delete_node_from_available_list(t_zone* zone, BYTE* node_to_d
     set_node_available(node_to_delete, FALSE);
 }
 
+static inline void clear_free_list(t_zone* zone) {
+    zone->first_free_node = NULL;
+    zone->last_free_node = NULL;
+    __atomic_store_n(&zone->largest_free_size, 0, __ATOMIC_RELAXED);
+}
+#endif
+
+#ifdef DEFERRED_COALESCING
+/// deferred node is available for neighbours, so they can merge it, but it isn't in free lists.
+/// Summary is raised to the size node gets after merging with available neighbours,
+/// so allocation which fits only after coalescing still looks into zone.
+static inline void add_node_to_deferred_list(t_zone* zone, BYTE* node_to_add) {
+    BYTE* first_node = zone->first_deferred_node;
+    t_allocation_type type = get_node_allocation_type(node_to_add);
+    uint64_t merged_size = get_node_size(node_to_add, type);
+    BYTE* prev_node = get_prev_node(zone, node_to_add);
+    BYTE* next_node = get_next_node(zone, node_to_add);
+    if (prev_node != NULL && get_node_available(prev_node)) {
+        merged_size += NODE_HEADER_SIZE + get_node_size(prev_node, type);
+    }
+    if (next_node != NULL && get_node_available(next_node)) {
+        merged_size += NODE_HEADER_SIZE + get_node_size(next_node, type);
+    }
+
+    set_prev_free_node(node_to_add, NULL);
+    set_next_free_node(node_to_add, first_node);
+    if (first_node != NULL) {
+        set_prev_free_node(first_node, node_to_add);
+    }
+    zone->first_deferred_node = node_to_add;
+    ++zone->deferred_nodes_number;
+    if (merged_size > zone->deferred_largest_size) {
+        zone->deferred_largest_size = merged_size;
+    }
+    set_node_available(node_to_add, TRUE);
+    set_node_deferred(node_to_add, TRUE);
+    raise_zone_largest_free_size(zone, merged_size);
+}
+
+static inline void delete_node_from_deferred_list(t_zone* zone, BYTE* node_to_delete) {
+    BYTE* prev_node = get_prev_free_node(zone, node_to_delete);
+    BYTE* next_node = get_next_free_node(zone, node_to_delete);
+
+    if (prev_node == NULL) {
+        zone->first_deferred_node = next_node;
+    }
+    else {
+        set_next_free_node(prev_node, next_node);
+    }
+    if (next_node != NULL) {
+        set_prev_free_node(next_node, prev_node);
+    }
+    --zone->deferred_nodes_number;
+
+    set_prev_free_node(node_to_delete, NULL);
+    set_next_free_node(node_to_delete, NULL);
+    set_node_available(node_to_delete, FALSE);
+    set_node_deferred(node_to_delete, FALSE);
+}
+#endif
+
+/// available list operations go to TLSF for small zones with TLSF, to zone free lists otherwise.
+/// Deferred nodes are deleted from deferred list (DEFERRED_COALESCING).
+static inline void add_node_to_available_list(t_zone* zone, BYTE* node_to_add) {
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        tlsf_add_node(zone, node_to_add);
+        return;
+    }
+#endif
+    add_node_to_free_list(zone, node_to_add);
+}
+
+static inline void delete_node_from_available_list(t_zone* zone, BYTE* node_to_delete) {
+#ifdef DEFERRED_COALESCING
+    if (get_node_deferred(node_to_delete)) {
+        delete_node_from_deferred_list(zone, node_to_delete);
+        return;
+    }
+#endif
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        tlsf_delete_node(zone, node_to_delete);
+        return;
+    }
+#endif
+    delete_node_from_free_list(zone, node_to_delete);
+}
+
+static inline void clear_available_list(t_zone* zone) {
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        bzero(zone->tlsf, sizeof(t_tlsf));
+    }
+#endif
+#ifdef DEFERRED_COALESCING
+    zone->first_deferred_node = NULL;
+    zone->deferred_nodes_number = 0;
+    zone->deferred_largest_size = 0;
+#endif
+    clear_free_list(zone);
+}
+
+static inline BOOL zone_has_available_nodes(t_zone* zone) {
+#ifdef DEFERRED_COALESCING
+    if (zone->first_deferred_node != NULL) {
+        return TRUE;
+    }
+#endif
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        return zone->tlsf->fl_bitmap != 0;
+    }
+#endif
+#ifdef SEGREGATED_FREE_LISTS
+    return zone->free_lists_bitmap != 0;
+#else
+    return zone->first_free_node != NULL;
+#endif
+}
+
+/// small zone with TLSF has its control block mapped after nodes memory.
+static inline uint64_t get_zone_mapping_size(t_zone* zone) {
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        return ZONE_HEADER_SIZE + zone->total_size + sizeof(t_tlsf);
+    }
+#endif
+    return ZONE_HEADER_SIZE + zone->total_size;
+}
+
 static inline void add_zone_to_list(t_zone** first_zone, t_zone** last_zone, t_zone* zone_to_add) {
     if (*first_zone == NULL) {
         zone_to_add->prev = NULL;
@@ -294,6 +684,24 @@ static inline uint64_t get_zone_not_used_mem_size(t_zone* zone) {
     return zone->total_size - zone_occupied_memory_size;
 }
 
+/// With PURGE_FREE_SPANS tail pages which have been used since purge or mmap are taken from purged tail.
+static inline void update_zone_tail_size(t_zone* zone) {
+    uint64_t tail_size = get_zone_not_used_mem_size(zone);
+    __atomic_store_n(&zone->tail_size, tail_size, __ATOMIC_RELAXED);
+#ifdef PURGE_FREE_SPANS
+    BYTE* used_memory_end = page_ceil((BYTE*)zone + ZONE_HEADER_SIZE + zone->total_size - tail_size);
+    if (zone->purged_tail < used_memory_end) {
+        zone->purged_tail = used_memory_end;
+    }
+#endif
+}
+
+/// FALSE means zone can't give required_size for sure.
+static inline BOOL zone_may_fit(t_zone* zone, uint64_t required_size) {
+    return __atomic_load_n(&zone->largest_free_size, __ATOMIC_RELAXED) >= required_size ||
+           __atomic_load_n(&zone->tail_size, __ATOMIC_RELAXED) >= NODE_HEADER_SIZE + required_size;
+}
+
 static inline t_allocation_type to_allocation_type(uint64_t size) {
     if (size <= TINE_ALLOCATION_MAX_SIZE) {
         return Tiny;
@@ -301,17 +709,112 @@ static inline t_allocation_type to_allocation_type(uint64_t size) {
     if (size <= SMALL_ALLOCATION_MAX_SIZE) {
         return Small;
     }
+#ifdef MEDIUM_CLASS
+    if (size <= MEDIUM_ALLOCATION_MAX_SIZE) {
+        return Medium;
+    }
+#endif
     return Large;
 }
 
+#ifdef HUGE_PAGES
+/// mapping_size is the whole zone memory with header.
+static inline BOOL is_huge_page_zone(t_allocation_type type, uint64_t mapping_size) {
+    if (type != Large) {
+        return __atomic_load_n(&gHugePagesZones, __ATOMIC_RELAXED);
+    }
+    uint64_t large_min_size = __atomic_load_n(&gHugePagesLargeMinSize, __ATOMIC_RELAXED);
+    return large_min_size != 0 && mapping_size >= large_min_size;
+}
+#endif
+
 static inline uint64_t calculate_zone_size(t_allocation_type type, uint64_t size) {
     switch (type) {
         case Tiny:
             return TINY_ZONE_SIZE;
         case Small:
             return SMALL_ZONE_SIZE;
+#ifdef MEDIUM_CLASS
+        case Medium:
+            return MEDIUM_ZONE_SIZE;
+#endif
         case Large:
             size += ZONE_HEADER_SIZE + NODE_HEADER_SIZE;
+#ifdef HUGE_PAGES
+            if (is_huge_page_zone(Large, size)) {
+                return (size + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+            }
+#endif
             return size + gPageSize - size % gPageSize;
     }
 }
+
+/// zone list of tiny, small or medium class.
+static inline void get_class_zone_list(t_memory_zones* arena, t_allocation_type type,
+                                       t_zone*** first_zone, t_zone*** last_zone) {
+#ifdef MEDIUM_CLASS
+    if (type == Medium) {
+        *first_zone = &arena->first_medium_zone;
+        *last_zone = &arena->last_medium_zone;
+        return;
+    }
+#endif
+    *first_zone = type == Tiny ? &arena->first_tiny_zone : &arena->first_small_zone;
+    *last_zone = type == Tiny ? &arena->last_tiny_zone : &arena->last_small_zone;
+}
+
+/// the smallest allocation size of class.
+static inline uint64_t get_class_min_size(t_allocation_type type) {
+    switch (type) {
+        case Tiny:
+            return 16;
+        case Small:
+            return TINE_ALLOCATION_MAX_SIZE + 16;
+        default:
+            return SMALL_ALLOCATION_MAX_SIZE + 16;
+    }
+}
+
+#ifdef ZONE_STATE_LISTS
+/// partial lists are the usual class lists, so code which doesn't know about states keeps working.
+static inline void get_zone_list(t_memory_zones* arena, t_allocation_type type, t_zone_state state,
+                                 t_zone*** first_zone, t_zone*** last_zone) {
+    if (state == ZonePartial) {
+        get_class_zone_list(arena, type, first_zone, last_zone);
+    }
+    else if (state == ZoneFull) {
+        *first_zone = &arena->first_full_zones[type];
+        *last_zone = &arena->last_full_zones[type];
+    }
+    else {
+        *first_zone = &arena->first_empty_zones[type];
+        *last_zone = &arena->last_empty_zones[type];
+    }
+}
+
+/// zone lock should be held. Zone is full if it can't give the smallest node of its class.
+static inline t_zone_state get_actual_zone_state(t_zone* zone, t_allocation_type type) {
+    if (zone->last_allocated_node == NULL) {
+        return ZoneEmpty;
+    }
+    uint64_t min_node_size = get_class_min_size(type);
+    if (zone->tail_size < NODE_HEADER_SIZE + min_node_size &&
+        (!zone_has_available_nodes(zone) || zone->largest_free_size < min_node_size)) {
+        return ZoneFull;
+    }
+    return ZonePartial;
+}
+
+/// zone lock should be held. Returns TRUE if zone should be moved to another list by refresh_zone_state.
+/// With FINE_GRAINED_LOCKS refresh is called after zone lock is released, zone is pinned till then,
+/// so refresh can move it without looking for it in class lists.
+static inline BOOL zone_needs_refresh(t_zone* zone, t_allocation_type type) {
+    if (zone->state == get_actual_zone_state(zone, type)) {
+        return FALSE;
+    }
+#ifdef FINE_GRAINED_LOCKS
+    ++zone->pending_refreshes;
+#endif
+    return TRUE;
+}
+#endif
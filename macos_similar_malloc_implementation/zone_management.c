@@ -1,5 +1,23 @@
 #include "malloc_internal.h"
 #include "utilities.h"
+#if defined(DECAY) || defined(LARGE_CACHE)
+#include <time.h>
+
+/// monotonic time in ms.
+uint64_t decay_now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000 + (uint64_t)time.tv_nsec / 1000000;
+}
+#endif
+
+#ifdef DECAY
+uint64_t gDecayTimeMs = DECAY_TIME_DEFAULT_MS;
+#endif
+
+#ifdef PURGE_FREE_SPANS
+ALLOCATOR_TLS t_purged_memory tPurgedMemory;
+#endif
 
 void take_away_node_part_and_make_it_available(BYTE* first_node, uint64_t first_node_new_size, t_zone* zone,
                                                t_allocation_type type) {
@@ -43,26 +61,153 @@ void merge_node_with_prev_set_both_occupied(t_zone* zone, t_node_representation*
     }
 }
 
-void*
-take_memory_from_free_nodes(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type) {
+/// takes node from free list, splits it if the rest is big enough.
+/// Rest of purged node stays purged, only its header page is touched.
+static inline void* take_free_node(t_zone* zone, BYTE* node, uint64_t node_size, uint64_t required_size,
+                                   uint64_t separate_size, t_allocation_type type) {
+    delete_node_from_available_list(zone, node);
+#ifdef PURGE_FREE_SPANS
+    BOOL purged = get_node_purged(node);
+    set_node_purged(node, FALSE);
+#endif
+
+    if (node_size - required_size >= separate_size) {
+        take_away_node_part_and_make_it_available(node, required_size, zone, type);
+#ifdef PURGE_FREE_SPANS
+        BYTE* rest_node = get_next_node(zone, node);
+        if (rest_node != NULL) {
+            set_node_purged(rest_node, purged);
+        }
+#endif
+    }
+
+#ifdef PURGE_FREE_SPANS
+    if (purged) {
+        report_purged_memory(page_ceil(node + NODE_HEADER_SIZE),
+                             node + NODE_HEADER_SIZE + get_node_size(node, type));
+    }
+#endif
+    return (void*)(node + NODE_HEADER_SIZE);
+}
+
+#ifdef SEGREGATED_FREE_LISTS
+/// Every node of exact list fits. In power of two list node can be smaller than required,
+/// so a few first nodes are checked, then the first node of any bigger non empty list fits for sure.
+static inline void*
+take_memory_from_free_list(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type) {
+    uint64_t index = to_free_list_index(required_size);
+
+    BYTE* current_node = zone->free_lists[index];
+    for (uint64_t i = 0; current_node != NULL && i < FREE_LISTS_FIT_ATTEMPTS; ++i) {
+        uint64_t current_node_size = get_node_size(current_node, type);
+        if (current_node_size >= required_size) {
+            return take_free_node(zone, current_node, current_node_size, required_size, separate_size, type);
+        }
+        current_node = get_next_free_node(zone, current_node);
+    }
+
+    uint32_t bigger_lists = zone->free_lists_bitmap & ~((2u << index) - 1);
+    if (bigger_lists == 0) {
+        return NULL;
+    }
+    current_node = zone->free_lists[__builtin_ctz(bigger_lists)];
+    return take_free_node(zone, current_node, get_node_size(current_node, type), required_size, separate_size, type);
+}
+#else
+static inline void*
+take_memory_from_free_list(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type) {
     for (BYTE* current_node = zone->first_free_node;
          current_node != NULL; current_node = get_next_free_node(zone, current_node)) {
 
         t_node_representation current_node_representation = get_node_representation(current_node);
 
         if (current_node_representation.size >= required_size) {
-            delete_node_from_available_list(zone, current_node);
-
-            if (current_node_representation.size - required_size >= separate_size) {
-                take_away_node_part_and_make_it_available(current_node, required_size, zone, type);
-            }
-
-            return (void*)(current_node + NODE_HEADER_SIZE);
+            return take_free_node(zone, current_node, current_node_representation.size, required_size,
+                                  separate_size, type);
         }
     }
 
     return NULL;
 }
+#endif
+
+#ifdef TLSF
+/// Good fit: node of rounded up size list fits for sure. If there is no such node, only the first node
+/// of required size list is checked, so search doesn't depend on free nodes number.
+static inline void*
+take_memory_from_tlsf(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type) {
+    uint64_t fl, sl;
+    tlsf_mapping(tlsf_round_up(required_size), &fl, &sl);
+    BYTE* node = tlsf_find_suitable(zone->tlsf, fl, sl);
+    if (node == NULL) {
+        tlsf_mapping(required_size, &fl, &sl);
+        node = zone->tlsf->free_lists[fl][sl];
+        if (node == NULL || get_node_size(node, type) < required_size) {
+            return NULL;
+        }
+    }
+    return take_free_node(zone, node, get_node_size(node, type), required_size, separate_size, type);
+}
+#endif
+
+#ifdef SEGREGATED_FREE_LISTS
+/// After failed search: nodes of smaller lists and of required size list checked to its end are smaller
+/// than required. If required size list is longer than FREE_LISTS_FIT_ATTEMPTS, only its range end is known.
+static inline uint64_t free_list_size_bound(t_zone* zone, uint64_t required_size) {
+    uint64_t index = to_free_list_index(required_size);
+    BYTE* current_node = zone->free_lists[index];
+    for (uint64_t i = 0; current_node != NULL && i < FREE_LISTS_FIT_ATTEMPTS; ++i) {
+        current_node = get_next_free_node(zone, current_node);
+    }
+    if (current_node == NULL) {
+        return required_size - 16;
+    }
+    if (index == FREE_LISTS_COUNT - 1) {
+        return zone->largest_free_size;
+    }
+    return (1ull << (index - FREE_LISTS_EXACT_COUNT + 8)) - 16;
+}
+#else
+static inline uint64_t free_list_size_bound(t_zone* zone, uint64_t required_size) {
+    (void)zone;
+    return required_size - 16;
+}
+#endif
+
+#ifdef TLSF
+/// After failed search all lists from the rounded up one are empty. Required size list is empty
+/// or its first node is too small, in the last case its nodes are only known to be below the next list.
+static inline uint64_t tlsf_size_bound(t_zone* zone, uint64_t required_size) {
+    uint64_t fl, sl;
+    tlsf_mapping(required_size, &fl, &sl);
+    if (zone->tlsf->free_lists[fl][sl] == NULL) {
+        return required_size - 16;
+    }
+    uint64_t list_step = 1ull << (63 - (uint64_t)__builtin_clzll(required_size) - TLSF_SL_COUNT_LOG2);
+    return (required_size & ~(list_step - 1)) + list_step - 16;
+}
+#endif
+
+/// largest free node size the zone can still have after take_memory_from_free_nodes failed.
+/// Search isn't exhaustive with SEGREGATED_FREE_LISTS and TLSF, so it can be bigger than required size.
+static inline uint64_t free_nodes_size_bound(t_zone* zone, uint64_t required_size) {
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        return tlsf_size_bound(zone, required_size);
+    }
+#endif
+    return free_list_size_bound(zone, required_size);
+}
+
+void*
+take_memory_from_free_nodes(t_zone* zone, uint64_t required_size, uint64_t separate_size, t_allocation_type type) {
+#ifdef TLSF
+    if (zone->tlsf != NULL) {
+        return take_memory_from_tlsf(zone, required_size, separate_size, type);
+    }
+#endif
+    return take_memory_from_free_list(zone, required_size, separate_size, type);
+}
 
 void* take_not_marked_memory_from_zone(t_zone* zone, uint64_t required_size, t_allocation_type type) {
     BYTE* last_allocated_node = zone->last_allocated_node;
@@ -79,8 +224,16 @@ void* take_not_marked_memory_from_zone(t_zone* zone, uint64_t required_size, t_a
 
     if (zone_available_size >= NODE_HEADER_SIZE + required_size) {
         BYTE* node = (BYTE*)zone + ZONE_HEADER_SIZE + zone_occupied_memory_size;
+#ifdef DECAY
+        zone->free_since = 0;
+#endif
 
         construct_node_header(zone, node, required_size, last_allocated_node_size, type);
+#ifdef PURGE_FREE_SPANS
+        BYTE* purged_start = page_ceil(node + NODE_HEADER_SIZE);
+        report_purged_memory(purged_start > zone->purged_tail ? purged_start : zone->purged_tail,
+                             node + NODE_HEADER_SIZE + required_size);
+#endif
 
         zone->last_allocated_node = node;
         return (void*)(node + NODE_HEADER_SIZE);
@@ -88,20 +241,55 @@ void* take_not_marked_memory_from_zone(t_zone* zone, uint64_t required_size, t_a
     return NULL;
 }
 
+#ifdef DEFERRED_COALESCING
+static void coalesce_deferred_nodes(t_zone* zone);
+#endif
+
+/// after failed search in free nodes summary is lowered to the bound the search proves (see free_nodes_size_bound).
+/// With DEFERRED_COALESCING the last deferred node is taken at once if it has exactly required size,
+/// deferred nodes are merged before giving up if merging can make node big enough.
 void* take_memory_from_zone(t_zone* zone, uint64_t required_size, uint64_t separate_size,
                             t_allocation_type type) {
-    void* mem = take_memory_from_free_nodes(zone, required_size, separate_size, type);
-    if (mem) {
-        return mem;
+    void* mem = NULL;
+#ifdef DEFERRED_COALESCING
+    BYTE* deferred_node = zone->first_deferred_node;
+    if (deferred_node != NULL && get_node_size(deferred_node, type) == required_size) {
+        delete_node_from_deferred_list(zone, deferred_node);
+        mem = (void*)(deferred_node + NODE_HEADER_SIZE);
+    }
+#endif
+    if (!mem && zone->largest_free_size >= required_size) {
+        mem = take_memory_from_free_nodes(zone, required_size, separate_size, type);
+#ifdef DEFERRED_COALESCING
+        if (!mem && zone->first_deferred_node != NULL && zone->deferred_largest_size >= required_size) {
+            coalesce_deferred_nodes(zone);
+            mem = take_memory_from_free_nodes(zone, required_size, separate_size, type);
+        }
+#endif
+        if (!mem) {
+            uint64_t size_bound = free_nodes_size_bound(zone, required_size);
+            if (size_bound < zone->largest_free_size) {
+                __atomic_store_n(&zone->largest_free_size, size_bound, __ATOMIC_RELAXED);
+            }
+        }
     }
-    mem = take_not_marked_memory_from_zone(zone, required_size, type);
+    if (!mem) {
+        mem = take_not_marked_memory_from_zone(zone, required_size, type);
+    }
+    update_zone_tail_size(zone);
     return mem;
 }
 
+/// zones which can't give required_size by summary are skipped without locking.
 void* take_memory_from_zone_list(t_zone* first_zone, uint64_t required_size, uint64_t separate_size,
                                  t_allocation_type type) {
     for (t_zone* current_zone = first_zone; current_zone != NULL; current_zone = current_zone->next) {
+        if (!zone_may_fit(current_zone, required_size)) {
+            continue;
+        }
+        zone_lock_acquire(current_zone);
         void* memory = take_memory_from_zone(current_zone, required_size, separate_size, type);
+        zone_lock_release(current_zone);
         if (memory != NULL) {
             return memory;
         }
@@ -112,17 +300,44 @@ void* take_memory_from_zone_list(t_zone* first_zone, uint64_t required_size, uin
 void clear_zone_list(t_zone* current_zone) {
     while (current_zone != NULL) {
         t_zone* next_zone = current_zone->next;
-        munmap((void*)current_zone, current_zone->total_size + ZONE_HEADER_SIZE);
+        unmap_zone(current_zone);
         current_zone = next_zone;
     }
 }
 
-void free_memory_in_zone_list(t_zone** first_zone, t_zone** last_zone, BYTE* node) {
+#ifdef PURGE_FREE_SPANS
+/// merged node is purged if it has purged part and dirty memory doesn't touch any of its whole pages.
+static BOOL is_merged_node_purged(BYTE* node, uint64_t size, BYTE* dirty_start, BYTE* dirty_end) {
+    BYTE* pages_start = page_ceil(node + NODE_HEADER_SIZE);
+    BYTE* pages_end = page_floor(node + NODE_HEADER_SIZE + size);
+    BYTE* dirty_pages_start = page_floor(dirty_start);
+    BYTE* dirty_pages_end = page_ceil(dirty_end);
+    return (dirty_pages_start > pages_start ? dirty_pages_start : pages_start) >=
+           (dirty_pages_end < pages_end ? dirty_pages_end : pages_end);
+}
+#endif
+
+/// releases node with merging, returns TRUE if it was the last node and zone became totally free.
+/// With PURGE_FREE_SPANS freed node and not purged neighbours are dirty memory of merged node.
+static BOOL release_node(t_zone* zone, BYTE* node) {
     t_node_representation current_node_representation = get_node_representation(node);
-    t_zone* zone = current_node_representation.zone;
+#ifdef PURGE_FREE_SPANS
+    zone->dirty_size += NODE_HEADER_SIZE + current_node_representation.size;
+    BYTE* dirty_start = node;
+    BYTE* dirty_end = node + NODE_HEADER_SIZE + current_node_representation.size;
+    BOOL has_purged_part = FALSE;
+#endif
 
     /// merge with prev node if possible
     if (current_node_representation.prev_node != NULL && get_node_available(current_node_representation.prev_node)) {
+#ifdef PURGE_FREE_SPANS
+        if (get_node_purged(current_node_representation.prev_node)) {
+            has_purged_part = TRUE;
+        }
+        else {
+            dirty_start = current_node_representation.prev_node;
+        }
+#endif
         merge_node_with_prev_set_both_occupied(zone, &current_node_representation);
         current_node_representation = get_node_representation(current_node_representation.prev_node);
     }
@@ -130,6 +345,15 @@ void free_memory_in_zone_list(t_zone** first_zone, t_zone** last_zone, BYTE* nod
     /// merge with next node if possible
     if (current_node_representation.next_node != NULL && get_node_available(current_node_representation.next_node)) {
         t_node_representation next_node_representation = get_node_representation(current_node_representation.next_node);
+#ifdef PURGE_FREE_SPANS
+        if (get_node_purged(next_node_representation.raw_node)) {
+            has_purged_part = TRUE;
+            dirty_end += NODE_HEADER_SIZE;
+        }
+        else {
+            dirty_end = next_node_representation.raw_node + NODE_HEADER_SIZE + next_node_representation.size;
+        }
+#endif
         merge_node_with_prev_set_both_occupied(zone, &next_node_representation);
         current_node_representation = get_node_representation(current_node_representation.raw_node);
     }
@@ -137,31 +361,321 @@ void free_memory_in_zone_list(t_zone** first_zone, t_zone** last_zone, BYTE* nod
     /// processing if released node is last last allocated node.
     if (current_node_representation.raw_node == zone->last_allocated_node) {
 
-        /// if current node is last allocated node and we can delete zone (there is more than one zones)
-        /// we delete zone from list and unmap it.
-        if (current_node_representation.prev_node == NULL && *first_zone != *last_zone) {
-            delete_zone_from_list(first_zone, last_zone, zone);
-            munmap((void*)zone, ZONE_HEADER_SIZE + zone->total_size);
-            return;
-        }
-
-        /// if current node is last zone node, but we can't delete zone (there is only one zone)
-        /// we mark zone like totally free (without free node list)
+        /// if current node is last zone node we mark zone like totally free (without free node list)
         if (current_node_representation.prev_node == NULL) {
             zone->last_allocated_node = NULL;
-            zone->first_free_node = NULL;
-            zone->last_free_node = NULL;
-            return;
+            clear_available_list(zone);
+#ifdef DECAY
+            zone->free_since = decay_now();
+#endif
+            return TRUE;
         }
 
         /// we don't add node to free nodes list if it last, just unmark it
         zone->last_allocated_node = current_node_representation.prev_node;
-        return;
+#ifdef DEFERRED_COALESCING
+        /// deferred nodes aren't merged, so there can be more available nodes before the new last one
+        while (get_node_available(zone->last_allocated_node)) {
+            BYTE* prev_node = get_prev_node(zone, zone->last_allocated_node);
+            delete_node_from_available_list(zone, zone->last_allocated_node);
+            if (prev_node == NULL) {
+                zone->last_allocated_node = NULL;
+                clear_available_list(zone);
+#ifdef DECAY
+                zone->free_since = decay_now();
+#endif
+                return TRUE;
+            }
+            zone->last_allocated_node = prev_node;
+        }
+#endif
+        return FALSE;
     }
     add_node_to_available_list(zone, current_node_representation.raw_node);
+#ifdef PURGE_FREE_SPANS
+    set_node_purged(current_node_representation.raw_node,
+                    has_purged_part && is_merged_node_purged(current_node_representation.raw_node,
+                                                             current_node_representation.size, dirty_start, dirty_end));
+#endif
+    return FALSE;
 }
 
-BOOL reallocate_memory_in_zone(BYTE* raw_node, uint64_t new_size, uint64_t separate_size) {
+#ifdef PURGE_FREE_SPANS
+/// Zone lock should be held. Nodes are walked by address, only headers are read. Deferred nodes aren't purged,
+/// they are taken back as is, without purged mark check.
+void purge_free_spans(t_zone* zone) {
+    zone->dirty_size = 0;
+    BYTE* node = zone->last_allocated_node != NULL ? (BYTE*)zone + ZONE_HEADER_SIZE : NULL;
+    for (; node != NULL; node = get_next_node(zone, node)) {
+        if (!get_node_available(node) || get_node_purged(node) || get_node_deferred(node)) {
+            continue;
+        }
+        BYTE* pages_start = page_ceil(node + NODE_HEADER_SIZE);
+        BYTE* pages_end = page_floor(node + NODE_HEADER_SIZE + get_node_size(node, get_node_allocation_type(node)));
+        if (pages_end >= pages_start + PURGE_MIN_SIZE) {
+            madvise(pages_start, pages_end - pages_start, PURGE_PAGES_MADVISE);
+            set_node_purged(node, TRUE);
+        }
+    }
+
+    /// zone memory end can share page with TLSF control block
+    BYTE* zone_memory_end = (BYTE*)zone + ZONE_HEADER_SIZE + zone->total_size;
+    BYTE* tail_start = page_ceil(zone_memory_end - get_zone_not_used_mem_size(zone));
+    BYTE* tail_end = zone->purged_tail < page_floor(zone_memory_end) ? zone->purged_tail : page_floor(zone_memory_end);
+    if (tail_end >= tail_start + PURGE_MIN_SIZE) {
+        madvise(tail_start, tail_end - tail_start, PURGE_PAGES_MADVISE);
+        zone->purged_tail = tail_start;
+    }
+}
+#endif
+
+#ifdef DEFERRED_COALESCING
+/// every deferred node is released as usual, release can merge and take away other deferred nodes.
+static void coalesce_deferred_nodes(t_zone* zone) {
+    BYTE* node;
+    while ((node = zone->first_deferred_node) != NULL) {
+        delete_node_from_deferred_list(zone, node);
+        release_node(zone, node);
+    }
+    zone->deferred_largest_size = 0;
+}
+
+/// node is only marked available and deferred, so freeing and taking the same size again
+/// doesn't split and merge nodes. The last allocated node is released at once to keep zone tail exact.
+static BOOL free_memory_in_zone(t_zone* zone, BYTE* node) {
+    if (node != zone->last_allocated_node) {
+        if (zone->deferred_nodes_number < DEFERRED_COALESCING_MAX_NODES) {
+            add_node_to_deferred_list(zone, node);
+            return FALSE;
+        }
+        coalesce_deferred_nodes(zone);
+    }
+    return release_node(zone, node);
+}
+#else
+static inline BOOL free_memory_in_zone(t_zone* zone, BYTE* node) {
+    return release_node(zone, node);
+}
+#endif
+
+#ifdef PURGE_FREE_SPANS
+/// totally free zone is left to unmap or decay.
+static inline void purge_free_spans_if_needed(t_zone* zone) {
+    if (zone->last_allocated_node != NULL && zone->dirty_size >= zone->total_size / PURGE_DIRTY_RATIO) {
+        purge_free_spans(zone);
+    }
+}
+#endif
+
+#if defined(FINE_GRAINED_LOCKS) && !defined(ZONE_STATE_LISTS)
+static BOOL zone_list_contains_zone(t_zone* current_zone, t_zone* zone) {
+    for (; current_zone != NULL; current_zone = current_zone->next) {
+        if (current_zone == zone) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+#endif
+
+#ifdef ZONE_STATE_LISTS
+/// class lock should be held.
+static void move_zone_to_state_list(t_zone* zone, t_allocation_type type, t_zone_state state) {
+    t_zone** first_zone;
+    t_zone** last_zone;
+    get_zone_list(zone->arena, type, zone->state, &first_zone, &last_zone);
+    delete_zone_from_list(first_zone, last_zone, zone);
+    get_zone_list(zone->arena, type, state, &first_zone, &last_zone);
+    add_zone_to_list(first_zone, last_zone, zone);
+    zone->state = state;
+}
+
+/// class lock should be held. Nobody else can touch empty zone nodes, it's moved to partial list first.
+void* take_memory_from_empty_zone(t_memory_zones* arena, uint64_t required_size, uint64_t separate_size,
+                                  t_allocation_type type) {
+    t_zone* zone = arena->first_empty_zones[type];
+    if (zone == NULL) {
+        return NULL;
+    }
+    zone_lock_acquire(zone);
+    move_zone_to_state_list(zone, type, ZonePartial);
+    void* memory = take_memory_from_zone(zone, required_size, separate_size, type);
+    zone_lock_release(zone);
+    return memory;
+}
+
+/// class lock should be held, zone is the one malloc has just taken memory from.
+void mark_zone_full_if_needed(t_zone* zone, t_allocation_type type) {
+    zone_lock_acquire(zone);
+    if (zone->state == ZonePartial && get_actual_zone_state(zone, type) == ZoneFull) {
+        move_zone_to_state_list(zone, type, ZoneFull);
+    }
+    zone_lock_release(zone);
+}
+
+/// Zone is moved to list of its actual state after zone_needs_refresh returned TRUE, class and zone locks
+/// shouldn't be held. The first empty zone of class is kept, others are unmapped (with DECAY by decay pass).
+/// With FINE_GRAINED_LOCKS zone lock was released, so meanwhile zone could be taken by malloc or moved
+/// by another refresh, its list is found by its state. It can't be unmapped while refresh is pending.
+void refresh_zone_state(t_memory_zones* arena, t_zone* zone, t_allocation_type type) {
+    class_lock_acquire(arena, type);
+    zone_lock_acquire(zone);
+    t_zone_state state = get_actual_zone_state(zone, type);
+    if (state != zone->state) {
+        move_zone_to_state_list(zone, type, state);
+    }
+    BOOL can_delete_zone = FALSE;
+#ifdef FINE_GRAINED_LOCKS
+    --zone->pending_refreshes;
+#endif
+#ifndef DECAY
+    can_delete_zone = state == ZoneEmpty && arena->first_empty_zones[type] != arena->last_empty_zones[type];
+#ifdef FINE_GRAINED_LOCKS
+    can_delete_zone = can_delete_zone && zone->pending_refreshes == 0;
+#endif
+    if (can_delete_zone) {
+        delete_zone_from_list(&arena->first_empty_zones[type], &arena->last_empty_zones[type], zone);
+    }
+#endif
+    zone_lock_release(zone);
+    class_lock_release(arena, type);
+    if (can_delete_zone) {
+        unmap_zone(zone);
+    }
+}
+
+/// zone lists are found by zone state, so list arguments aren't needed.
+void free_memory_in_zone_list(t_zone** first_zone, t_zone** last_zone, BYTE* node) {
+    t_zone* zone = get_node_zone(node);
+    t_memory_zones* arena = zone->arena;
+    t_allocation_type type = get_node_allocation_type(node);
+    (void)first_zone;
+    (void)last_zone;
+
+    zone_lock_acquire(zone);
+    free_memory_in_zone(zone, node);
+    update_zone_tail_size(zone);
+#ifdef PURGE_FREE_SPANS
+    purge_free_spans_if_needed(zone);
+#endif
+    BOOL zone_state_changed = zone_needs_refresh(zone, type);
+    zone_lock_release(zone);
+    if (zone_state_changed) {
+        refresh_zone_state(arena, zone, type);
+    }
+}
+#else
+void free_memory_in_zone_list(t_zone** first_zone, t_zone** last_zone, BYTE* node) {
+    t_zone* zone = get_node_zone(node);
+    t_memory_zones* arena = zone->arena;
+    t_allocation_type type = get_node_allocation_type(node);
+
+    zone_lock_acquire(zone);
+    BOOL zone_is_free = free_memory_in_zone(zone, node);
+    update_zone_tail_size(zone);
+#ifdef PURGE_FREE_SPANS
+    purge_free_spans_if_needed(zone);
+#endif
+    zone_lock_release(zone);
+#ifdef DECAY
+    /// zone stays in list, arena_decay unmaps it if nobody takes memory from it during decay time
+    zone_is_free = FALSE;
+#endif
+    if (!zone_is_free) {
+        return;
+    }
+
+    /// if zone is totally free and we can delete it (there is more than one zones)
+    /// we delete zone from list and unmap it.
+    /// With FINE_GRAINED_LOCKS zone lock was released, so meanwhile zone could be taken by malloc
+    /// or even removed by another free, it's checked again under class lock.
+    /// Nobody can touch free zone nodes while class lock is held, so zone lock isn't needed.
+    class_lock_acquire(arena, type);
+    BOOL can_delete_zone = *first_zone != *last_zone;
+#ifdef FINE_GRAINED_LOCKS
+    can_delete_zone = can_delete_zone && zone_list_contains_zone(*first_zone, zone) && zone->last_allocated_node == NULL;
+#endif
+    if (can_delete_zone) {
+        delete_zone_from_list(first_zone, last_zone, zone);
+    }
+    class_lock_release(arena, type);
+    if (can_delete_zone) {
+        unmap_zone(zone);
+    }
+}
+#endif
+
+#ifdef DECAY
+/// zone header page is kept, it's the only part of free zone which is still used.
+static void purge_zone(t_zone* zone) {
+    madvise((BYTE*)zone + gPageSize, ZONE_HEADER_SIZE + zone->total_size - gPageSize, PURGE_PAGES_MADVISE);
+    zone->free_since = DECAY_PURGED;
+#ifdef PURGE_FREE_SPANS
+    zone->purged_tail = (BYTE*)zone + gPageSize;
+#endif
+}
+
+/// Expired zones are removed from list under class lock and unmapped after it's released.
+/// Empty zone nodes can't be touched by anybody except malloc, which needs class lock,
+/// zone lock is taken only to read free_since consistently.
+static void decay_zone_list(t_memory_zones* arena, t_allocation_type type, t_zone** first_zone, t_zone** last_zone,
+                            uint64_t now) {
+    uint64_t decay_time = __atomic_load_n(&gDecayTimeMs, __ATOMIC_RELAXED);
+    t_zone* zones_to_unmap = NULL;
+    uint64_t zones_to_unmap_number = 0;
+
+    class_lock_acquire(arena, type);
+    t_zone* zone = *first_zone;
+    while (zone != NULL && zones_to_unmap_number < DECAY_MAX_ZONES_PER_PASS) {
+        t_zone* next_zone = zone->next;
+        zone_lock_acquire(zone);
+        BOOL expired = zone->last_allocated_node == NULL && zone->free_since != 0 &&
+                       zone->free_since != DECAY_PURGED && now >= zone->free_since + decay_time;
+#if defined(ZONE_STATE_LISTS) && defined(FINE_GRAINED_LOCKS)
+        expired = expired && zone->pending_refreshes == 0;
+#endif
+        zone_lock_release(zone);
+        if (expired) {
+            if (*first_zone != *last_zone) {
+                delete_zone_from_list(first_zone, last_zone, zone);
+                zone->next = zones_to_unmap;
+                zones_to_unmap = zone;
+                ++zones_to_unmap_number;
+            }
+            else {
+                purge_zone(zone);
+            }
+        }
+        zone = next_zone;
+    }
+    class_lock_release(arena, type);
+
+    clear_zone_list(zones_to_unmap);
+}
+
+/// arena lock should be held, with FINE_GRAINED_LOCKS class locks shouldn't be held.
+void arena_decay(t_memory_zones* arena, uint64_t now) {
+#ifdef ZONE_STATE_LISTS
+    /// free zones are only in empty lists
+    decay_zone_list(arena, Tiny, &arena->first_empty_zones[Tiny], &arena->last_empty_zones[Tiny], now);
+    decay_zone_list(arena, Small, &arena->first_empty_zones[Small], &arena->last_empty_zones[Small], now);
+#ifdef MEDIUM_CLASS
+    decay_zone_list(arena, Medium, &arena->first_empty_zones[Medium], &arena->last_empty_zones[Medium], now);
+#endif
+#else
+    decay_zone_list(arena, Tiny, &arena->first_tiny_zone, &arena->last_tiny_zone, now);
+    decay_zone_list(arena, Small, &arena->first_small_zone, &arena->last_small_zone, now);
+#ifdef MEDIUM_CLASS
+    decay_zone_list(arena, Medium, &arena->first_medium_zone, &arena->last_medium_zone, now);
+#endif
+#endif
+#ifdef TINY_SLABS
+    slab_decay(arena, now);
+#endif
+}
+#endif
+
+static BOOL reallocate_node(BYTE* raw_node, uint64_t new_size, uint64_t separate_size) {
     t_node_representation node_representation = get_node_representation(raw_node);
     t_zone* zone = node_representation.zone;
 
@@ -204,19 +718,103 @@ BOOL reallocate_memory_in_zone(BYTE* raw_node, uint64_t new_size, uint64_t separ
     return FALSE;
 }
 
-t_zone* create_new_zone(size_t size) {
+BOOL reallocate_memory_in_zone(BYTE* raw_node, uint64_t new_size, uint64_t separate_size) {
+    BOOL reallocated = reallocate_node(raw_node, new_size, separate_size);
+    update_zone_tail_size(get_node_zone(raw_node));
+    return reallocated;
+}
+
+#ifdef HUGE_PAGES
+BOOL gHugePagesZones = TRUE;
+uint64_t gHugePagesLargeMinSize = HUGE_PAGES_LARGE_MIN_SIZE_DEFAULT;
+
+/// mapping bigger by huge page is trimmed, so zone starts on huge page boundary. Advice is only a hint,
+/// zone is usable if kernel ignores it.
+static void* map_huge_page_zone(size_t size) {
+    BYTE* mapping = (BYTE*)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                                VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+    if ((void*)mapping == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    BYTE* zone_start = (BYTE*)(((uint64_t)mapping + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1));
+    if (zone_start != mapping) {
+        munmap(mapping, zone_start - mapping);
+    }
+    munmap(zone_start + size, mapping + HUGE_PAGE_SIZE - zone_start);
+    madvise(zone_start, size, MADV_HUGEPAGE);
+    return zone_start;
+}
+#endif
+
+t_zone* create_new_zone(size_t size, t_allocation_type type, t_memory_zones* arena) {
+#ifdef HUGE_PAGES
+    t_zone* new_zone = size % HUGE_PAGE_SIZE == 0 && is_huge_page_zone(type, size)
+                       ? (t_zone*)map_huge_page_zone(size)
+                       : (t_zone*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                                       VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+#else
     t_zone* new_zone = (t_zone*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
                                      VM_MAKE_TAG(VM_MEMORY_MALLOC), 0);
+#endif
     if ((void*)new_zone == MAP_FAILED) {
         return NULL;
     }
+    if (!construct_zone_header(new_zone, size, type, arena)) {
+        munmap((void*)new_zone, size);
+        return NULL;
+    }
+    return new_zone;
+}
+
+/// size is the whole zone memory with header. Returns FALSE if zone can't be set to page map.
+BOOL construct_zone_header(t_zone* new_zone, size_t size, t_allocation_type type, t_memory_zones* arena) {
     new_zone->last_allocated_node = NULL;
     new_zone->total_size = size - ZONE_HEADER_SIZE;
-    new_zone->first_free_node = NULL;
-    new_zone->last_free_node = NULL;
+#ifdef TLSF
+    new_zone->tlsf = NULL;
+    if (type != Tiny && type != Large) {
+        new_zone->total_size -= sizeof(t_tlsf);
+        new_zone->tlsf = (t_tlsf*)((BYTE*)new_zone + size - sizeof(t_tlsf));
+    }
+#endif
+    new_zone->tail_size = new_zone->total_size;
+    clear_available_list(new_zone);
     new_zone->prev = NULL;
     new_zone->next = NULL;
+    new_zone->arena = arena;
+#if defined(DECAY) || defined(LARGE_CACHE)
+    new_zone->free_since = 0;
+#endif
+#ifdef ZONE_STATE_LISTS
+    new_zone->state = ZonePartial;
+#ifdef FINE_GRAINED_LOCKS
+    new_zone->pending_refreshes = 0;
+#endif
+#endif
+#ifdef FINE_GRAINED_LOCKS
+    lock_init(&new_zone->lock);
+#endif
+#ifdef BUDDY_ALLOCATOR
+    new_zone->buddy_region = NULL;
+#endif
+#ifdef PURGE_FREE_SPANS
+    new_zone->purged_tail = page_ceil((BYTE*)new_zone + ZONE_HEADER_SIZE);
+    new_zone->dirty_size = 0;
+#endif
+#ifdef SAFE_FREE
+    return page_map_set(new_zone, type);
+#else
+#ifndef TLSF
+    (void)type;
+#endif
+    return TRUE;
+#endif
+}
 
-    return new_zone;
+void unmap_zone(t_zone* zone) {
+#ifdef SAFE_FREE
+    page_map_clear(zone);
+#endif
+    munmap((void*)zone, get_zone_mapping_size(zone));
 }
 
@@ -55,11 +55,12 @@ static inline size_t get_current_time(void)
     return (timeval_to_size_t(timeval));
 }
 
-int main()
+/// thread number can be passed as first argument, see bench.sh
+int main(int argc, char** argv)
 {
     size_t start_time = get_current_time();
 
-    size_t thread_num = 16;
+    size_t thread_num = argc > 1 ? (size_t)atoi(argv[1]) : 16;
     pthread_t threads[thread_num];
 
 	for (size_t i = 0; i < thread_num; ++i) {
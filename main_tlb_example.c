@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+/// Every thread allocates a lot of tiny and small nodes and one large buffer, links nodes in random order
+/// and walks them, touching random buffer pages on the way. Working set is spread over hundreds of mb,
+/// so almost every step misses TLB with 4 kb pages.
+/// Run with library built with and without HUGE_PAGES to compare, prints time in ms and dTLB load misses
+/// (-1 if perf events aren't available), see bench.sh
+
+#define NODES_NUMBER 1000000
+#define LARGE_BUFFER_SIZE 0x4000000 /// 64 mb
+#define STEPS_NUMBER 20000000
+
+typedef struct s_node {
+    struct s_node* next;
+    size_t value;
+} t_node;
+
+static size_t gThreadNum;
+
+static inline size_t next_random(size_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void *thread(void *ptr)
+{
+    size_t random_state = (size_t)ptr + 88172645463325252ULL;
+    t_node** nodes = malloc(NODES_NUMBER * sizeof(t_node*));
+    for (size_t i = 0; i < NODES_NUMBER; ++i) {
+        /// tiny and small sizes
+        nodes[i] = malloc(sizeof(t_node) + next_random(&random_state) % 400);
+    }
+    for (size_t i = NODES_NUMBER - 1; i > 0; --i) {
+        size_t j = next_random(&random_state) % (i + 1);
+        t_node* node = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = node;
+    }
+    for (size_t i = 0; i < NODES_NUMBER; ++i) {
+        nodes[i]->next = nodes[(i + 1) % NODES_NUMBER];
+        nodes[i]->value = i;
+    }
+    volatile char* buffer = malloc(LARGE_BUFFER_SIZE);
+    for (size_t i = 0; i < LARGE_BUFFER_SIZE; i += 4096) {
+        buffer[i] = (char)i;
+    }
+
+    size_t sum = 0;
+    t_node* node = nodes[0];
+    for (size_t i = 0; i < STEPS_NUMBER; ++i) {
+        sum += node->value + buffer[(node->value * 4099) % LARGE_BUFFER_SIZE];
+        node = node->next;
+    }
+
+    for (size_t i = 0; i < NODES_NUMBER; ++i) {
+        free(nodes[i]);
+    }
+    free(nodes);
+    free((void*)buffer);
+    return (void*)sum;
+}
+
+static inline size_t timeval_to_size_t(struct timeval timeval)
+{
+    return (timeval.tv_sec * 1000 + (size_t)(timeval.tv_usec * 0.001));
+}
+
+static inline size_t get_current_time(void)
+{
+    struct timeval	timeval;
+
+    gettimeofday(&timeval, NULL);
+    return (timeval_to_size_t(timeval));
+}
+
+/// dTLB load misses counter of this process and threads created after it, -1 if it can't be opened.
+static int open_dtlb_misses_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr = {0};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/// thread number can be passed as first argument
+int main(int argc, char** argv)
+{
+    gThreadNum = argc > 1 ? (size_t)atoi(argv[1]) : 1;
+    pthread_t threads[gThreadNum];
+
+    int counter = open_dtlb_misses_counter();
+    size_t start_time = get_current_time();
+    for (size_t i = 0; i < gThreadNum; ++i) {
+        pthread_create(&threads[i], NULL, thread, (void*)i);
+    }
+    for (size_t i = 0; i < gThreadNum; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    size_t time = get_current_time() - start_time;
+
+    long long misses = -1;
+    if (counter < 0 || read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+        misses = -1;
+    }
+    printf("%lu %lld\n", time, misses);
+    return 0;
+}
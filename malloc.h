@@ -14,6 +14,50 @@ void free(void *ptr);
 
 void free_all();
 
+/// with DEFERRED_FREE build option free() of the calling thread only queues memory,
+/// it's freed by background reclaimer thread. No-op without DEFERRED_FREE.
+void set_thread_deferred_free(int enabled);
+
+/// with DECAY build option totally free zones are kept for decay time (10 seconds by default)
+/// and given back to the system after it. No-op without DECAY.
+void set_decay_time(size_t milliseconds);
+
+/// with LARGE_CACHE build option freed large mappings are cached up to max_bytes (64 mb by default)
+/// for decay time (1 second by default) and reused by next large allocations. No-op without LARGE_CACHE.
+void set_large_cache_limits(size_t max_bytes, size_t decay_milliseconds);
+
+/// with HUGE_PAGES build option (Linux only) zones are mapped 2 mb aligned and advised to be backed
+/// by transparent huge pages, it lowers TLB misses for the price of RSS. zones_enabled = 0 turns it off
+/// for new tiny, small and medium zones, large mappings get it from large_min_size (4 mb by default),
+/// 0 turns it off for them. No-op without HUGE_PAGES.
+void set_huge_pages(int zones_enabled, size_t large_min_size);
+
 void print_alloc_mem();
 
 void print_alloc_mem_hex_dump();
+
+/// Lock profiling, available with LOCK_PROFILING build option and turned on by set_lock_profiling(1).
+/// Lock acquisitions are counted per public function they were made from,
+/// wait_histogram[i] counts contended acquisitions which waited [2^i, 2^(i+1)) ns.
+#define LOCK_PROFILE_MALLOC 0  /// malloc and valloc
+#define LOCK_PROFILE_FREE 1
+#define LOCK_PROFILE_REALLOC 2
+#define LOCK_PROFILE_CALLOC 3
+#define LOCK_PROFILE_OTHER 4  /// free_all, dumps, thread exit
+#define LOCK_PROFILE_WAIT_HISTOGRAM_SIZE 32
+
+typedef struct s_lock_profile {
+    unsigned long long acquisitions;
+    unsigned long long contended_acquisitions;
+    unsigned long long wait_time_ns;
+    unsigned long long wait_histogram[LOCK_PROFILE_WAIT_HISTOGRAM_SIZE];
+} t_lock_profile;
+
+void set_lock_profiling(int enabled);
+
+/// returns 0 without LOCK_PROFILING or for unknown call site.
+int get_lock_profile(int call_site, t_lock_profile* profile);
+
+void reset_lock_profile();
+
+void print_lock_profile();
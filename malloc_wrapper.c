@@ -1,74 +1,510 @@
+#ifdef __linux__
+#define _GNU_SOURCE  /// sched_getcpu
+#endif
 #include "malloc.h"
 #include "macos_similar_malloc_implementation/malloc_internal.h"
+#include "macos_similar_malloc_implementation/utilities.h"
 #include <pthread.h>
+#include <time.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
-static pthread_mutex_t gMutex = PTHREAD_MUTEX_INITIALIZER;
+#if ARENAS_COUNT > 1
+static uint64_t gNextArenaIndex = 0;
+static ALLOCATOR_TLS int64_t tArenaIndex = -1;
+#endif
 
-static inline void mutex_lock(pthread_mutex_t* mutex) {
-#ifdef THREAD_SAFE
-    pthread_mutex_lock(mutex);
+/// Thread works with arena of CPU it's running on, so threads on different CPUs rarely meet on one arena lock.
+/// If CPU number isn't available, threads are distributed between arenas by round-robin on first use.
+static inline t_memory_zones* get_thread_arena() {
+#if ARENAS_COUNT > 1
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return &gArenas[(uint64_t)cpu % ARENAS_COUNT];
+    }
 #endif
+    if (tArenaIndex < 0) {
+        tArenaIndex = (int64_t)(__atomic_fetch_add(&gNextArenaIndex, 1, __ATOMIC_RELAXED) % ARENAS_COUNT);
+    }
+    return &gArenas[tArenaIndex];
+#else
+    return &gMemoryZones;
+#endif
+}
+
+/// init is done once under main arena lock, before any arena is used.
+static inline void init_once() {
+    if (!__atomic_load_n(&gInit, __ATOMIC_ACQUIRE)) {
+        lock_acquire(&gMemoryZones.lock);
+        if (!gInit) {
+            init();
+        }
+        lock_release(&gMemoryZones.lock);
+    }
+}
+
+static inline void lock_all_arenas() {
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        arena_lock_all_acquire(&gArenas[i]);
+    }
+    lock_large_allocations();
+}
+
+static inline void unlock_all_arenas() {
+    unlock_large_allocations();
+    for (uint64_t i = ARENAS_COUNT; i > 0; --i) {
+        arena_lock_all_release(&gArenas[i - 1]);
+    }
+}
+
+/// called before dumps and free_all, so remotely freed nodes are freed for real (large ones are unmapped).
+static inline void drain_all_arenas() {
+    for (uint64_t i = 0; i < ARENAS_COUNT; ++i) {
+        arena_lock_acquire(&gArenas[i]);
+        arena_drain_remote_frees(&gArenas[i]);
+        arena_lock_release(&gArenas[i]);
+    }
+}
+
+#ifdef THREAD_CACHE
+static ALLOCATOR_TLS t_thread_cache tThreadCache;
+static ALLOCATOR_TLS BOOL tThreadCacheRegistered = FALSE;
+static pthread_key_t gThreadCacheKey;
+static pthread_once_t gThreadCacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/// called on thread exit, returns all cached nodes to zones.
+static void thread_cache_destructor(void* cache) {
+    lock_set_site(LockSiteOther);
+    thread_cache_flush((t_thread_cache*)cache);
+}
+
+static void create_thread_cache_key() {
+    pthread_key_create(&gThreadCacheKey, thread_cache_destructor);
+}
+
+static inline t_thread_cache* get_thread_cache() {
+    if (!tThreadCacheRegistered) {
+        tThreadCacheRegistered = TRUE;
+        pthread_once(&gThreadCacheKeyOnce, create_thread_cache_key);
+        pthread_setspecific(gThreadCacheKey, &tThreadCache);
+    }
+    return &tThreadCache;
 }
+#endif
 
-static inline void mutex_unlock(pthread_mutex_t* mutex) {
-#ifdef THREAD_SAFE
-    pthread_mutex_unlock(mutex);
+static inline void* allocate(size_t size) {
+    init_once();
+    /// large allocations don't touch arena zones, so arena lock isn't needed
+    if (size >= LARGE_ALLOCATION_MIN_SIZE) {
+        return arena_malloc(get_thread_arena(), size);
+    }
+#ifdef THREAD_CACHE
+    t_thread_cache* cache = get_thread_cache();
+    void* mem = thread_cache_take(cache, size);
+    if (mem) {
+        return mem;
+    }
+    return thread_cache_refill(cache, get_thread_arena(), size);
+#else
+    t_memory_zones* arena = get_thread_arena();
+    arena_lock_acquire(arena);
+    void* mem = arena_malloc(arena, size);
+    arena_lock_release(arena);
+    return mem;
 #endif
 }
 
 void* malloc(size_t size) {
-    mutex_lock(&gMutex);
-    void* tmp = __malloc(size);
-    mutex_unlock(&gMutex);
-    return tmp;
+    lock_set_site(LockSiteMalloc);
+    return allocate(size);
 }
 
 void* realloc(void* ptr, size_t size) {
-    mutex_lock(&gMutex);
+    lock_set_site(LockSiteRealloc);
+    if (ptr == NULL) {
+        return allocate(size);
+    }
+    /// large memory stays large or is moved to new large allocation, arena lock isn't needed
+    if (get_user_memory_allocation_type(ptr) == Large && size != 0) {
+        return __realloc(ptr, size);
+    }
+    t_memory_zones* arena = get_user_memory_arena(ptr);
+    arena_lock_acquire(arena);
     void* tmp = __realloc(ptr, size);
-    mutex_unlock(&gMutex);
+    arena_lock_release(arena);
     return tmp;
 }
 
-void free(void* ptr) {
-    mutex_lock(&gMutex);
+#if defined(DEFERRED_FREE) || !(defined(THREAD_CACHE) || defined(REMOTE_FREE))
+/// frees straight into owning arena under its lock, without thread cache and remote free list.
+static void free_to_arena(void* ptr) {
+#ifdef SAFE_FREE
+    t_allocation_type type;
+    t_memory_zones* arena = find_user_memory_arena(ptr, &type);
+    if (!arena) {
+        return;
+    }
+#else
+    t_memory_zones* arena = get_user_memory_arena(ptr);
+    t_allocation_type type = get_user_memory_allocation_type(ptr);
+#endif
+    /// __free checks ptr again under lock which is held while its zone is unmapped (SAFE_FREE)
+    if (type == Large) {
+        __free(ptr);
+        return;
+    }
+    arena_lock_acquire(arena);
+    __free(ptr);
+    arena_lock_release(arena);
+}
+#endif
+
+static void free_now(void* ptr) {
+#if defined(THREAD_CACHE)
+    t_thread_cache* cache = get_thread_cache();
+    if (!thread_cache_put(cache, ptr)) {
+        thread_cache_release(cache, ptr);
+    }
+#elif defined(REMOTE_FREE)
+#ifdef SAFE_FREE
+    t_allocation_type type;
+    t_memory_zones* arena = find_user_memory_arena(ptr, &type);
+    if (!arena) {
+        return;
+    }
+#else
+    t_memory_zones* arena = get_user_memory_arena(ptr);
+    t_allocation_type type = get_user_memory_allocation_type(ptr);
+#endif
+    /// __free checks ptr again under lock which is held while its zone is unmapped (SAFE_FREE)
+    if (type == Large) {
+        __free(ptr);
+        return;
+    }
+    /// memory of another arena or busy arena: owner will free it on its next malloc or free
+    if (arena != get_thread_arena() || !arena_lock_try_acquire(arena)) {
+        arena_push_remote_free(arena, ptr);
+        return;
+    }
+    arena_drain_remote_frees(arena);
     __free(ptr);
-    mutex_unlock(&gMutex);
+    arena_lock_release(arena);
+#else
+    free_to_arena(ptr);
+#endif
+}
+
+#ifdef DEFERRED_FREE
+#define DEFERRED_FREE_RECLAIM_INTERVAL_NS 1000000  /// 1 ms
+
+static ALLOCATOR_TLS t_deferred_free_ring* tDeferredFreeRing = NULL;
+static pthread_key_t gDeferredFreeKey;
+static pthread_once_t gDeferredFreeOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gReclaimerMutex = PTHREAD_MUTEX_INITIALIZER;  /// only one thread drains rings at a time
+static pthread_cond_t gReclaimerCond = PTHREAD_COND_INITIALIZER;  /// on monotonic clock, see start_reclaimer
+static BOOL gReclaimerIdle = FALSE;  /// reclaimer sleeps without timeout, the next push wakes it
+
+/// gReclaimerMutex should be held. Reclaimer never allocates, so memory put into its thread cache
+/// or pushed to remote free list of the owner arena would stay there, it's freed into arena at once.
+static void reclaim_deferred_frees() {
+    for (t_deferred_free_ring* ring = __atomic_load_n(&gDeferredFreeRings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        void* ptr;
+        while ((ptr = deferred_free_pop(ring)) != NULL) {
+            free_to_arena(ptr);
+        }
+    }
+}
+
+static BOOL deferred_frees_queued() {
+    for (t_deferred_free_ring* ring = __atomic_load_n(&gDeferredFreeRings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        if (deferred_free_ring_size(ring) != 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void reclaimer_wait_interval() {
+#ifdef __APPLE__
+    struct timespec interval = {0, DEFERRED_FREE_RECLAIM_INTERVAL_NS};
+    pthread_cond_timedwait_relative_np(&gReclaimerCond, &gReclaimerMutex, &interval);
+#else
+    struct timespec wake_time;
+    clock_gettime(CLOCK_MONOTONIC, &wake_time);
+    wake_time.tv_nsec += DEFERRED_FREE_RECLAIM_INTERVAL_NS;
+    if (wake_time.tv_nsec >= 1000000000) {
+        wake_time.tv_sec += 1;
+        wake_time.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&gReclaimerCond, &gReclaimerMutex, &wake_time);
+#endif
+}
+
+/// Reclaimer wakes up every DEFERRED_FREE_RECLAIM_INTERVAL_NS while pointers are queued,
+/// or when some ring is half full. If rings are empty, it sleeps until the next push.
+/// Idle flag is set before rings are checked, so push done after the check sees the flag.
+static void* reclaimer_routine(void* arg) {
+    lock_set_site(LockSiteFree);
+    pthread_mutex_lock(&gReclaimerMutex);
+    while (TRUE) {
+        reclaim_deferred_frees();
+        __atomic_store_n(&gReclaimerIdle, TRUE, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!deferred_frees_queued()) {
+            while (__atomic_load_n(&gReclaimerIdle, __ATOMIC_SEQ_CST)) {
+                pthread_cond_wait(&gReclaimerCond, &gReclaimerMutex);
+            }
+            continue;
+        }
+        __atomic_store_n(&gReclaimerIdle, FALSE, __ATOMIC_SEQ_CST);
+        reclaimer_wait_interval();
+    }
+    return arg;
+}
+
+/// mutex is taken, so the wake up can't be lost between reclaimer check and its wait.
+static void wake_idle_reclaimer() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&gReclaimerIdle, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&gReclaimerIdle, FALSE, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&gReclaimerMutex);
+        pthread_cond_signal(&gReclaimerCond);
+        pthread_mutex_unlock(&gReclaimerMutex);
+    }
+}
+
+/// called on thread exit, ring is given back with its pointers, reclaimer frees them.
+static void deferred_free_ring_destructor(void* ring) {
+    deferred_free_ring_release((t_deferred_free_ring*)ring);
+}
+
+static void start_reclaimer() {
+    pthread_t reclaimer;
+
+#ifndef __APPLE__
+    /// wall clock jumps don't change reclaim interval
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gReclaimerCond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+#endif
+    pthread_key_create(&gDeferredFreeKey, deferred_free_ring_destructor);
+    if (pthread_create(&reclaimer, NULL, reclaimer_routine, NULL) == 0) {
+        pthread_detach(reclaimer);
+    }
+}
+
+/// pointer is freed right away if ring is full or holds too much memory.
+static inline BOOL defer_free(void* ptr) {
+#ifdef SAFE_FREE
+    /// ring should contain only valid pointers, reading their size isn't safe otherwise
+    t_allocation_type type;
+    if (!find_user_memory_arena(ptr, &type)) {
+        return TRUE;
+    }
+#endif
+    if (!deferred_free_push(tDeferredFreeRing, ptr)) {
+        pthread_cond_signal(&gReclaimerCond);
+        return FALSE;
+    }
+    if (deferred_free_ring_size(tDeferredFreeRing) == DEFERRED_FREE_RING_CAPACITY / 2) {
+        pthread_cond_signal(&gReclaimerCond);
+    }
+    wake_idle_reclaimer();
+    return TRUE;
+}
+#endif
+
+/// makes free() of the calling thread deferred, real free is done by reclaimer thread.
+void set_thread_deferred_free(int enabled) {
+#ifdef DEFERRED_FREE
+    if (enabled && tDeferredFreeRing == NULL) {
+        pthread_once(&gDeferredFreeOnce, start_reclaimer);
+        tDeferredFreeRing = deferred_free_ring_acquire();
+        pthread_setspecific(gDeferredFreeKey, tDeferredFreeRing);
+    }
+    else if (!enabled && tDeferredFreeRing != NULL) {
+        pthread_setspecific(gDeferredFreeKey, NULL);
+        deferred_free_ring_release(tDeferredFreeRing);
+        tDeferredFreeRing = NULL;
+    }
+#else
+    (void)enabled;
+#endif
+}
+
+/// frees all deferred pointers right now, used before free_all and dumps.
+static inline void reclaim_now() {
+#ifdef DEFERRED_FREE
+    pthread_mutex_lock(&gReclaimerMutex);
+    reclaim_deferred_frees();
+    pthread_mutex_unlock(&gReclaimerMutex);
+#endif
+}
+
+void free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    lock_set_site(LockSiteFree);
+#ifdef DEFERRED_FREE
+    if (tDeferredFreeRing != NULL && defer_free(ptr)) {
+        return;
+    }
+#endif
+    free_now(ptr);
+}
+
+/// zones which stay totally free longer than decay time are given back to the system.
+void set_decay_time(size_t milliseconds) {
+#ifdef DECAY
+    __atomic_store_n(&gDecayTimeMs, (uint64_t)milliseconds, __ATOMIC_RELAXED);
+#else
+    (void)milliseconds;
+#endif
 }
 
+/// freed large mappings are kept up to max_bytes in total and unmapped after decay time.
+/// Smaller max_bytes is applied on next free of large memory.
+void set_large_cache_limits(size_t max_bytes, size_t decay_milliseconds) {
+#ifdef LARGE_CACHE
+    __atomic_store_n(&gLargeCacheMaxBytes, (uint64_t)max_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&gLargeCacheDecayTimeMs, (uint64_t)decay_milliseconds, __ATOMIC_RELAXED);
+#else
+    (void)max_bytes;
+    (void)decay_milliseconds;
+#endif
+}
+
+/// applied to zones and large mappings created after the call, existing ones keep their pages.
+void set_huge_pages(int zones_enabled, size_t large_min_size) {
+#ifdef HUGE_PAGES
+    __atomic_store_n(&gHugePagesZones, (BOOL)(zones_enabled != 0), __ATOMIC_RELAXED);
+    __atomic_store_n(&gHugePagesLargeMinSize, (uint64_t)large_min_size, __ATOMIC_RELAXED);
+#else
+    (void)zones_enabled;
+    (void)large_min_size;
+#endif
+}
+
+#ifdef PURGED_MEMORY_IS_ZEROED
+/// purged pages reported by zone malloc are zero already. Report can be left by another allocation
+/// (thread cache refill), it doesn't overlap ptr memory then.
+static void bzero_not_purged_memory(void* ptr, size_t size) {
+    BYTE* start = (BYTE*)ptr;
+    BYTE* end = start + size;
+    BYTE* purged_start = tPurgedMemory.start > start ? tPurgedMemory.start : start;
+    BYTE* purged_end = tPurgedMemory.end < end ? tPurgedMemory.end : end;
+    if (tPurgedMemory.start == NULL || purged_start >= purged_end) {
+        bzero(ptr, size);
+        return;
+    }
+    bzero(start, purged_start - start);
+    bzero(purged_end, end - purged_end);
+}
+#endif
+
 void* calloc(size_t count, size_t size) {
-    mutex_lock(&gMutex);
-    void* ptr = __malloc(count * size);
-    bzero(ptr, count * size);
-    mutex_unlock(&gMutex);
+    /// not malloc() here, compiler can turn malloc + bzero into calloc call
+    lock_set_site(LockSiteCalloc);
+#ifdef PURGED_MEMORY_IS_ZEROED
+    tPurgedMemory.start = NULL;
+    void* ptr = allocate(count * size);
+    if (ptr) {
+        bzero_not_purged_memory(ptr, count * size);
+    }
+#else
+    void* ptr = allocate(count * size);
+    if (ptr) {
+        bzero(ptr, count * size);
+    }
+#endif
     return ptr;
 }
 
 void* valloc(size_t size) {
-    mutex_lock(&gMutex);
+    lock_set_site(LockSiteMalloc);
     /// needed for gPageSize
-    if (!gInit) {
-        init();
-    }
-    void* tmp = __malloc(size + gPageSize - size % gPageSize);
-    mutex_unlock(&gMutex);
-    return tmp;
+    init_once();
+    return allocate(size + gPageSize - size % gPageSize);
 }
 
 void free_all() {
-    mutex_lock(&gMutex);
+    lock_set_site(LockSiteOther);
+    reclaim_now();
+    drain_all_arenas();
+    lock_all_arenas();
     __free_all();
-    mutex_unlock(&gMutex);
+    unlock_all_arenas();
 }
 
 void print_alloc_mem() {
-    mutex_lock(&gMutex);
+    lock_set_site(LockSiteOther);
+    reclaim_now();
+    drain_all_arenas();
+    lock_all_arenas();
     __print_alloc_mem();
-    mutex_unlock(&gMutex);
+    unlock_all_arenas();
 }
 
 void print_alloc_mem_hex_dump() {
-    mutex_lock(&gMutex);
+    lock_set_site(LockSiteOther);
+    reclaim_now();
+    drain_all_arenas();
+    lock_all_arenas();
     __print_alloc_mem_hex_dump();
-    mutex_unlock(&gMutex);
+    unlock_all_arenas();
+}
+
+/// public call sites are listed in the same order as t_lock_site.
+#ifdef LOCK_PROFILING
+_Static_assert(LOCK_PROFILE_OTHER == LockSiteOther && LOCK_PROFILE_OTHER + 1 == LOCK_SITES_COUNT,
+               "public lock profile call sites differ from t_lock_site");
+_Static_assert(LOCK_PROFILE_WAIT_HISTOGRAM_SIZE == LOCK_PROFILE_HISTOGRAM_SIZE,
+               "public lock profile histogram size differs from internal one");
+#endif
+
+int get_lock_profile(int call_site, t_lock_profile* profile) {
+#ifdef LOCK_PROFILING
+    if (call_site < 0 || call_site >= LOCK_SITES_COUNT || profile == NULL) {
+        return 0;
+    }
+    t_lock_site_profile* site_profile = &gLockProfile[call_site];
+    profile->acquisitions = __atomic_load_n(&site_profile->acquisitions, __ATOMIC_RELAXED);
+    profile->contended_acquisitions = __atomic_load_n(&site_profile->contended_acquisitions, __ATOMIC_RELAXED);
+    profile->wait_time_ns = __atomic_load_n(&site_profile->wait_time_ns, __ATOMIC_RELAXED);
+    for (uint64_t i = 0; i < LOCK_PROFILE_HISTOGRAM_SIZE; ++i) {
+        profile->wait_histogram[i] = __atomic_load_n(&site_profile->wait_histogram[i], __ATOMIC_RELAXED);
+    }
+    return 1;
+#else
+    (void)call_site;
+    (void)profile;
+    return 0;
+#endif
+}
+
+void set_lock_profiling(int enabled) {
+#ifdef LOCK_PROFILING
+    __atomic_store_n(&gLockProfilingEnabled, enabled != 0, __ATOMIC_RELAXED);
+#else
+    (void)enabled;
+#endif
+}
+
+void reset_lock_profile() {
+#ifdef LOCK_PROFILING
+    __reset_lock_profile();
+#endif
+}
+
+void print_lock_profile() {
+#ifdef LOCK_PROFILING
+    __print_lock_profile();
+#endif
 }